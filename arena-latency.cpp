@@ -0,0 +1,259 @@
+/* TBB task_arena startup and teardown latency
+ *
+ * usage: ./arena-latency [-c count]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads>
+ *
+ * For each line, an arena of the given number of threads is created, made to
+ * run tasks until every worker has entered it (or 100ms have passed, if TBB
+ * cannot give it that many workers), and then terminated. TBB is allowed to
+ * create that many threads even on hosts with fewer cores. Sweep thread counts
+ * with e.g. `seq 2 16 | ./arena-latency -c 10`.
+ *
+ * Results are written to standard output with the following format:
+ *
+ * 	<threads> <workers> <init> <first> <last> <teardown> <reentries>
+ *
+ * Where workers is the number of distinct workers that entered the arena
+ * (reentries counts the times one of them entered it again), init is the
+ * time to construct and initialize() the arena, first and last are the times
+ * from submitting work until the first and the last worker entered the arena,
+ * and teardown is the time from the work being done until the last worker
+ * left the arena (0 if they all left while the work was finishing), waiting
+ * for at most a second after terminate(). All times are in seconds, or - if
+ * no worker arrived or not every worker left. Worker arrivals and departures
+ * are timestamped by the pinning observer's on_scheduler_entry and
+ * on_scheduler_exit hooks.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <oneapi/tbb.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock clk;
+
+/* Pins threads like noploop's and remembers when each worker first arrived
+ * and when the last one left
+ */
+class pinning_observer : public oneapi::tbb::task_scheduler_observer {
+	static std::atomic<unsigned long> generations;
+	/* Tells a worker's first entry from its later ones, even if this
+	 * observer is allocated where a previous one used to be
+	 */
+	const unsigned long generation;
+	const unsigned nprocs;
+	std::atomic<unsigned> count;
+	std::atomic<unsigned> workers;
+	std::atomic<unsigned> entries;
+	std::atomic<unsigned> left;
+	/* Entry time of each worker since the epoch, 0 until it arrives */
+	std::vector<std::atomic<clk::rep>> arrivals;
+	/* Latest exit time of a worker since the epoch */
+	std::atomic<clk::rep> last_exit;
+public:
+	pinning_observer(oneapi::tbb::task_arena &a, unsigned max_workers);
+	void on_scheduler_entry(bool is_worker);
+	void on_scheduler_exit(bool is_worker);
+	/* Number of distinct workers that entered so far */
+	unsigned nworkers() const;
+	/* Number of entries of workers that had entered before */
+	unsigned reentries() const;
+	/* Number of workers that entered and have not left */
+	unsigned inside() const;
+	clk::time_point departed() const;
+	/* Arrival times of the workers that entered so far */
+	std::vector<clk::time_point> arrived() const;
+};
+
+constexpr char tab = '\t';
+
+std::atomic<unsigned long> pinning_observer::generations(0);
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &a,
+		unsigned max_workers):
+		oneapi::tbb::task_scheduler_observer(a),
+		generation(++generations),
+		nprocs(get_nprocs()),
+		count(0),
+		workers(0),
+		entries(0),
+		left(0),
+		arrivals(max_workers),
+		last_exit(0)
+{
+	observe(true);
+}
+
+void
+pinning_observer::on_scheduler_entry(bool is_worker)
+{
+	auto now = clk::now();
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(count++ % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+	if (!is_worker)
+		return;
+	entries++;
+	thread_local unsigned long seen = 0;
+	if (seen == generation)
+		return;
+	seen = generation;
+	unsigned i = workers++;
+	if (i < arrivals.size())
+		arrivals[i] = now.time_since_epoch().count();
+}
+
+void
+pinning_observer::on_scheduler_exit(bool is_worker)
+{
+	if (!is_worker)
+		return;
+	clk::rep now = clk::now().time_since_epoch().count();
+	clk::rep prev = last_exit;
+	while (prev < now && !last_exit.compare_exchange_weak(prev, now))
+		;
+	left++;
+}
+
+unsigned
+pinning_observer::nworkers() const
+{
+	return workers;
+}
+
+unsigned
+pinning_observer::reentries() const
+{
+	return entries - workers;
+}
+
+unsigned
+pinning_observer::inside() const
+{
+	return entries - left;
+}
+
+clk::time_point
+pinning_observer::departed() const
+{
+	return clk::time_point(clk::duration(last_exit));
+}
+
+std::vector<clk::time_point>
+pinning_observer::arrived() const
+{
+	std::vector<clk::time_point> v;
+	for (auto &a : arrivals) {
+		clk::rep t = a;
+		if (t != 0)
+			v.push_back(clk::time_point(clk::duration(t)));
+	}
+	return v;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				<< std::endl;
+			return 1;
+		}
+	}
+	if (count < 1) {
+		std::cerr << "count must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	while (std::cin >> threads) {
+		if (threads < 2) {
+			std::cerr << "Threads must be >= 2" << std::endl;
+			continue;
+		}
+		/* The external thread takes one slot */
+		unsigned nworkers = threads - 1;
+		oneapi::tbb::global_control gc(
+				oneapi::tbb::global_control::max_allowed_parallelism,
+				threads);
+
+		for (int i = 0; i < count; i++) {
+			auto start = clk::now();
+			oneapi::tbb::task_arena arena(threads);
+			pinning_observer observer(arena, nworkers);
+			arena.initialize();
+			auto initialized = clk::now();
+
+			auto submitted = clk::now();
+			auto deadline = submitted + std::chrono::milliseconds(100);
+			arena.execute([&] {
+				oneapi::tbb::parallel_for(0, threads, [&] (int _) {
+					while (observer.nworkers() < nworkers
+							&& clk::now() < deadline)
+						asm("pause");
+				}, oneapi::tbb::simple_partitioner());
+			});
+			auto done = clk::now();
+			auto arrivals = observer.arrived();
+
+			arena.terminate();
+			auto give_up = clk::now() + std::chrono::seconds(1);
+			while (observer.inside() > 0 && clk::now() < give_up)
+				sched_yield();
+			bool all_left = observer.inside() == 0;
+			observer.observe(false);
+
+			std::chrono::duration<double> init = initialized - start;
+			std::cout << threads << tab;
+			std::cout << arrivals.size() << tab;
+			std::cout << init.count() << tab;
+			if (!arrivals.empty()) {
+				auto mm = std::minmax_element(arrivals.begin(),
+						arrivals.end());
+				std::chrono::duration<double> first =
+					*mm.first - submitted;
+				std::chrono::duration<double> last =
+					*mm.second - submitted;
+				std::cout << first.count() << tab;
+				std::cout << last.count() << tab;
+			} else {
+				std::cout << '-' << tab << '-' << tab;
+			}
+			if (!arrivals.empty() && all_left) {
+				std::chrono::duration<double> term = std::max(
+						observer.departed() - done,
+						clk::duration(0));
+				std::cout << term.count() << tab;
+			} else {
+				std::cout << '-' << tab;
+			}
+			std::cout << observer.reentries() << std::endl;
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
@@ -0,0 +1,232 @@
+/* Throughput of atomic operations, contended and uncontended
+ *
+ * usage: ./atomics [-c count]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <iterations>
+ *
+ * For each line, threads threads pinned round-robin to the hardware threads
+ * perform iterations operations between them, for every combination of:
+ *
+ * 	operation	fetch_add, exchange, cas_strong, cas_weak, store, load
+ * 	memory order	relaxed, acq_rel, seq_cst (acq_rel is acquire for
+ * 			loads and release for stores)
+ * 	sharing		shared (one variable for all threads) or private (one
+ * 			variable per thread, each in its own cache line)
+ *
+ * cas_strong and cas_weak are compare_exchange loops incrementing the
+ * variable. Results are written to standard output with the following format:
+ *
+ * 	<operation> <order> <sharing> <threads> <iterations> <time> <ops/sec>
+ *
+ * Each line is ran count times (default 1).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::uint64_t u64;
+
+enum op {
+	fetch_add,
+	exchange,
+	cas_strong,
+	cas_weak,
+	store,
+	load,
+};
+
+const char *op_names[] = {
+	"fetch_add", "exchange", "cas_strong", "cas_weak", "store", "load",
+};
+
+constexpr char tab = '\t';
+constexpr unsigned cache_line = 64;
+
+struct alignas(cache_line) padded {
+	std::atomic<u64> v {0};
+};
+
+/* Where loads are sunk so they are not optimized away */
+std::atomic<u64> sink;
+
+void
+pin(unsigned cpu)
+{
+	unsigned nprocs = get_nprocs();
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(cpu % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+constexpr std::memory_order
+load_order(std::memory_order o)
+{
+	return o == std::memory_order_acq_rel ? std::memory_order_acquire : o;
+}
+
+constexpr std::memory_order
+store_order(std::memory_order o)
+{
+	return o == std::memory_order_acq_rel ? std::memory_order_release : o;
+}
+
+const char *
+order_name(std::memory_order o)
+{
+	switch (o) {
+	case std::memory_order_relaxed:
+		return "relaxed";
+	case std::memory_order_acq_rel:
+		return "acq_rel";
+	default:
+		return "seq_cst";
+	}
+}
+
+/* n operations Op with memory order O on a */
+template <op Op, std::memory_order O>
+void
+apply(std::atomic<u64> &a, u64 n)
+{
+	u64 sum = 0;
+	for (u64 i = 0; i < n; ++i) {
+		switch (Op) {
+		case fetch_add:
+			a.fetch_add(1, O);
+			break;
+		case exchange:
+			a.exchange(i, O);
+			break;
+		case cas_strong: {
+			u64 v = a.load(std::memory_order_relaxed);
+			while (!a.compare_exchange_strong(v, v + 1, O,
+						std::memory_order_relaxed))
+				;
+			break;
+		}
+		case cas_weak: {
+			u64 v = a.load(std::memory_order_relaxed);
+			while (!a.compare_exchange_weak(v, v + 1, O,
+						std::memory_order_relaxed))
+				;
+			break;
+		}
+		case store:
+			a.store(i, store_order(O));
+			break;
+		case load:
+			sum += a.load(load_order(O));
+			break;
+		}
+	}
+	sink.fetch_add(sum, std::memory_order_relaxed);
+}
+
+template <op Op, std::memory_order O>
+void
+run(unsigned nthreads, u64 iterations, bool shared)
+{
+	std::vector<padded> vars(shared ? 1 : nthreads);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> go(false);
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		u64 n = iterations / nthreads + (t < iterations % nthreads);
+		threads.emplace_back([&, t, n] {
+			pin(t);
+			std::atomic<u64> &a = vars[shared ? 0 : t].v;
+			ready++;
+			while (!go)
+				;
+			apply<Op, O>(a, n);
+		});
+	}
+	while (ready != nthreads)
+		;
+	auto start = std::chrono::high_resolution_clock::now();
+	go = true;
+	for (auto &t : threads)
+		t.join();
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	double time = diff.count();
+
+	std::cout << op_names[Op] << tab;
+	std::cout << order_name(O) << tab;
+	std::cout << (shared ? "shared" : "private") << tab;
+	std::cout << nthreads << tab;
+	std::cout << iterations << tab;
+	std::cout << time << tab;
+	std::cout << (double)iterations / time << std::endl;
+}
+
+template <op Op>
+void
+run_orders(unsigned nthreads, u64 iterations)
+{
+	for (bool shared : {true, false}) {
+		run<Op, std::memory_order_relaxed>(nthreads, iterations, shared);
+		run<Op, std::memory_order_acq_rel>(nthreads, iterations, shared);
+		run<Op, std::memory_order_seq_cst>(nthreads, iterations, shared);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				<< std::endl;
+			return 1;
+		}
+	}
+	if (count < 1) {
+		std::cerr << "count must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	u64 iterations;
+
+	while (std::cin >> threads >> iterations) {
+		if (threads < 1) {
+			std::cerr << "Threads must be >= 1" << std::endl;
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			run_orders<fetch_add>(threads, iterations);
+			run_orders<exchange>(threads, iterations);
+			run_orders<cas_strong>(threads, iterations);
+			run_orders<cas_weak>(threads, iterations);
+			run_orders<store>(threads, iterations);
+			run_orders<load>(threads, iterations);
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
@@ -0,0 +1,180 @@
+/* Core-to-core cache line round-trip latency matrix
+ *
+ * usage: ./core-to-core [-c count] [-C cpulist] [roundtrips]
+ *
+ * For every ordered pair of CPUs (all of them, or the ones in cpulist, given
+ * like in sysfs, e.g. "0-3,8-11"), two threads pinned to them bounce a cache
+ * line back and forth roundtrips times (default 10000) by waiting for the
+ * other one's store to a shared atomic and answering with one of their own.
+ * Each pair is measured count times (default 3) and the fastest is kept, as
+ * it is the least disturbed by anything else running on the machine.
+ *
+ * The result is written to standard output as a tab-separated matrix with the
+ * CPUs in the first row and column, where row i and column j hold the average
+ * round-trip time in nanoseconds from CPU i to CPU j and back.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sched.h>
+#include <string>
+#include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define die(str) {std::cerr << progname << ": " << str << std::endl;\
+	std::exit(EXIT_FAILURE);}
+
+typedef std::uint64_t u64;
+
+constexpr char tab = '\t';
+constexpr unsigned cache_line = 64;
+
+const char *progname = "core-to-core";
+
+/* Pin the calling thread to cpu, the same way pinning_observer does */
+void
+pin(unsigned cpu)
+{
+	unsigned nprocs = get_nprocs_conf();
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(cpu, size, mask);
+	if (sched_setaffinity(0, size, mask))
+		die("sched_setaffinity(" << cpu << "): " << std::strerror(errno));
+	CPU_FREE(mask);
+}
+
+/* Parse a sysfs CPU list such as "0-3,8-11" */
+std::vector<unsigned>
+parse_cpulist(const std::string &s)
+{
+	std::vector<unsigned> cpus;
+	const char *p = s.c_str();
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		unsigned lo = std::strtoul(p, &end, 10), hi = lo;
+		if (*end == '-')
+			hi = std::strtoul(end + 1, &end, 10);
+		for (unsigned c = lo; c <= hi; ++c)
+			cpus.push_back(c);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cpus;
+}
+
+/* Spin, then yield in case the other thread shares our core */
+inline void
+await(const std::atomic<u64> &a, u64 value)
+{
+	for (unsigned spins = 0; a.load(std::memory_order_acquire) != value;
+			++spins) {
+		if (spins < 100000)
+			asm("pause");
+		else
+			sched_yield();
+	}
+}
+
+/* Average round trip from cpu a to cpu b and back, in nanoseconds */
+double
+roundtrip(unsigned a, unsigned b, u64 roundtrips)
+{
+	alignas(cache_line) std::atomic<u64> line(0);
+	std::atomic<bool> ready(false);
+	double result;
+
+	std::thread other([&] {
+		pin(b);
+		ready = true;
+		for (u64 k = 0; k < roundtrips; ++k) {
+			await(line, 2 * k + 1);
+			line.store(2 * k + 2, std::memory_order_release);
+		}
+	});
+	pin(a);
+	while (!ready)
+		;
+	auto start = std::chrono::steady_clock::now();
+	for (u64 k = 0; k < roundtrips; ++k) {
+		line.store(2 * k + 1, std::memory_order_release);
+		await(line, 2 * k + 2);
+	}
+	auto end = std::chrono::steady_clock::now();
+	other.join();
+	std::chrono::duration<double, std::nano> d = end - start;
+	result = d.count() / roundtrips;
+	return result;
+}
+
+int
+main(int argc, char *argv[])
+{
+	progname = argv[0];
+	int count = 3;
+	u64 roundtrips = 10000;
+	std::vector<unsigned> cpus;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:C:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		case 'C':
+			cpus = parse_cpulist(optarg);
+			break;
+		default:
+			die("usage: " << progname
+					<< " [-c count] [-C cpulist] [roundtrips]");
+		}
+	}
+	if (optind < argc) {
+		char *end;
+		roundtrips = std::strtoull(argv[optind], &end, 10);
+		if (*end != '\0')
+			die("roundtrips must be a valid integer");
+	}
+	if (count < 1 || roundtrips < 1)
+		die("count and roundtrips must be greater than 0");
+	if (cpus.empty())
+		for (unsigned c = 0; c < (unsigned)get_nprocs(); ++c)
+			cpus.push_back(c);
+
+	const unsigned n = cpus.size();
+	std::vector<double> matrix(n * n, 0);
+	for (unsigned i = 0; i < n; ++i) {
+		for (unsigned j = 0; j < n; ++j) {
+			if (i == j)
+				continue;
+			double best = roundtrip(cpus[i], cpus[j], roundtrips);
+			for (int k = 1; k < count; ++k)
+				best = std::min(best, roundtrip(cpus[i], cpus[j],
+							roundtrips));
+			matrix[i * n + j] = best;
+		}
+	}
+
+	for (unsigned j = 0; j < n; ++j)
+		std::cout << tab << cpus[j];
+	std::cout << std::endl;
+	for (unsigned i = 0; i < n; ++i) {
+		std::cout << cpus[i];
+		for (unsigned j = 0; j < n; ++j) {
+			std::cout << tab;
+			if (i == j)
+				std::cout << '-';
+			else
+				std::cout << matrix[i * n + j];
+		}
+		std::cout << std::endl;
+	}
+
+	std::exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,243 @@
+/* Scalable counter strategies under TBB
+ *
+ * usage: ./counters [-c count]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <iterations>
+ *
+ * For each line, a parallel_for of iterations iterations in an arena of
+ * threads threads increments a counter once per iteration, and then the
+ * counter is read, with each of these strategies:
+ *
+ * 	atomic		one std::atomic, incremented with fetch_add
+ * 	slots		cache line padded per-thread slots, indexed by
+ * 			this_task_arena::current_thread_index()
+ * 	combinable	tbb::combinable
+ * 	ets		tbb::enumerable_thread_specific
+ * 	registry	padded slots found through a thread_local pointer,
+ * 			registered in a mutex-protected list on first use
+ *
+ * Results are written to standard output with the following format:
+ *
+ * 	<strategy> <threads> <iterations> <time> <updates/sec> <read_time>
+ *
+ * Where read_time is the time it took to aggregate the counter afterwards.
+ * Each line is ran count times (default 1).
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <oneapi/tbb.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::uint64_t u64;
+typedef std::chrono::high_resolution_clock clk;
+
+constexpr char tab = '\t';
+constexpr unsigned cache_line = 64;
+
+class pinning_observer : public oneapi::tbb::task_scheduler_observer {
+	const unsigned nprocs;
+	std::atomic<unsigned> count;
+public:
+	pinning_observer(oneapi::tbb::task_arena &a);
+	void on_scheduler_entry(bool _w);
+};
+
+/* Only ever written by one thread, so increments need not be atomic RMWs */
+struct alignas(cache_line) slot {
+	std::atomic<u64> v {0};
+
+	void increment()
+	{
+		v.store(v.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+	}
+};
+
+/* Per-thread slots found through a thread_local cache and registered, on a
+ * thread's first increment, in a list that readers walk.
+ */
+class registry {
+	static std::atomic<u64> generations;
+	const u64 generation;
+	std::mutex mutex;
+	std::vector<std::unique_ptr<slot>> slots;
+public:
+	registry() : generation(++generations) {}
+	slot &local();
+	u64 sum();
+};
+
+std::atomic<u64> registry::generations(0);
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &a):
+		oneapi::tbb::task_scheduler_observer(a),
+		nprocs(get_nprocs()),
+		count(0)
+{
+	observe(true);
+}
+
+void
+pinning_observer::on_scheduler_entry(bool _w)
+{
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(count++ % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+slot &
+registry::local()
+{
+	/* The generation tells registries apart even if one is allocated
+	 * where a previous one used to be.
+	 */
+	thread_local u64 cached_generation = 0;
+	thread_local slot *cached = nullptr;
+	if (cached_generation == generation)
+		return *cached;
+	std::lock_guard<std::mutex> lock(mutex);
+	slots.emplace_back(new slot);
+	cached = slots.back().get();
+	cached_generation = generation;
+	return *cached;
+}
+
+u64
+registry::sum()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	u64 total = 0;
+	for (auto &s : slots)
+		total += s->v.load(std::memory_order_relaxed);
+	return total;
+}
+
+/* Time update() iterations times in parallel and then read() once */
+template <typename Update, typename Read>
+void
+measure(const char *name, oneapi::tbb::task_arena &arena, int threads,
+		u64 iterations, Update update, Read read)
+{
+	auto start = clk::now();
+	arena.execute([&] {
+		oneapi::tbb::parallel_for((u64)0, iterations,
+				[&] (const u64 &_) {
+			update();
+		});
+	});
+	auto updated = clk::now();
+	u64 total = read();
+	auto end = clk::now();
+	std::chrono::duration<double> update_time = updated - start;
+	std::chrono::duration<double> read_time = end - updated;
+	if (total != iterations)
+		std::cerr << name << ": counted " << total << " instead of "
+			<< iterations << std::endl;
+
+	std::cout << name << tab;
+	std::cout << threads << tab;
+	std::cout << iterations << tab;
+	std::cout << update_time.count() << tab;
+	std::cout << (double)iterations / update_time.count() << tab;
+	std::cout << read_time.count() << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				<< std::endl;
+			return 1;
+		}
+	}
+	if (count < 1) {
+		std::cerr << "count must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	u64 iterations;
+
+	while (std::cin >> threads >> iterations) {
+		if (threads < 1) {
+			std::cerr << "Threads must be >= 1" << std::endl;
+			continue;
+		}
+		oneapi::tbb::task_arena arena(threads);
+		pinning_observer observer(arena);
+		arena.initialize();
+
+		for (int i = 0; i < count; i++) {
+			std::atomic<u64> atomic(0);
+			measure("atomic", arena, threads, iterations, [&] {
+				atomic.fetch_add(1, std::memory_order_relaxed);
+			}, [&] {
+				return atomic.load();
+			});
+
+			std::vector<slot> slots(arena.max_concurrency());
+			measure("slots", arena, threads, iterations, [&] {
+				int t = oneapi::tbb::this_task_arena::
+					current_thread_index();
+				slots[t].increment();
+			}, [&] {
+				u64 total = 0;
+				for (auto &s : slots)
+					total += s.v.load(
+						std::memory_order_relaxed);
+				return total;
+			});
+
+			oneapi::tbb::combinable<u64> combinable([] {
+				return (u64)0;
+			});
+			measure("combinable", arena, threads, iterations, [&] {
+				combinable.local()++;
+			}, [&] {
+				return combinable.combine(std::plus<u64>());
+			});
+
+			oneapi::tbb::enumerable_thread_specific<u64> ets(0);
+			measure("ets", arena, threads, iterations, [&] {
+				ets.local()++;
+			}, [&] {
+				return ets.combine(std::plus<u64>());
+			});
+
+			registry reg;
+			measure("registry", arena, threads, iterations, [&] {
+				reg.local().increment();
+			}, [&] {
+				return reg.sum();
+			});
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
@@ -0,0 +1,387 @@
+/* Per-message overhead and latency of TBB flow graphs
+ *
+ * usage: ./flowgraph [-c count] [-n nodes] [-C concurrency] [-W work]
+ * 		[-l limit]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <messages>
+ *
+ * For each line, messages messages are sent from an input_node through each
+ * of these graphs, in an arena of threads threads:
+ *
+ * 	chain		nodes (default 4) function_nodes one after the other
+ * 	broadcast	a broadcast_node fanning out to nodes function_nodes
+ * 	join		a broadcast_node fanning out to two function_nodes, whose
+ * 			outputs are joined back by message by a join_node
+ * 	limiter		chain behind a limiter_node that lets at most limit
+ * 			(default 4 * threads) messages in at a time
+ *
+ * and through two hand-rolled equivalents built on a task_group:
+ *
+ * 	task_group_chain	a task per message and node, each running the
+ * 				next one
+ * 	task_group_broadcast	nodes tasks per message, the last of which to
+ * 				finish is the end of the message
+ *
+ * Every function_node (and task) does work NOPs (default 0) per message, and
+ * has a concurrency limit of concurrency (default 0, unlimited). Results are
+ * written to standard output with the following format:
+ *
+ * 	<graph> <threads> <messages> <nodes> <time> <messages/sec>
+ * 	<ns/message/node> <p50> <p99>
+ *
+ * Where nodes is the number of function_nodes (or tasks) each message went
+ * through, and p50 and p99 describe the time from a message being created
+ * until it went through the last of them, in seconds. Each line is ran count
+ * times (default 1).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <oneapi/tbb.h>
+#include <oneapi/tbb/flow_graph.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+
+#define NOP asm("NOP")
+
+typedef std::uint64_t u64;
+typedef std::chrono::steady_clock clk;
+
+namespace flow = oneapi::tbb::flow;
+
+class pinning_observer : public oneapi::tbb::task_scheduler_observer {
+	const unsigned nprocs;
+	std::atomic<unsigned> count;
+public:
+	pinning_observer(oneapi::tbb::task_arena &a);
+	void on_scheduler_entry(bool _w);
+};
+
+struct msg {
+	u64 i;
+	clk::rep start;
+};
+
+typedef flow::function_node<msg, msg> stage;
+
+/* What every graph is ran with */
+struct config {
+	int threads;
+	u64 messages;
+	unsigned nodes;
+	size_t concurrency; /* flow::unlimited for 0 */
+	u64 work;
+	size_t limit;
+};
+
+constexpr char tab = '\t';
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &a):
+		oneapi::tbb::task_scheduler_observer(a),
+		nprocs(get_nprocs()),
+		count(0)
+{
+	observe(true);
+}
+
+void
+pinning_observer::on_scheduler_entry(bool _w)
+{
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(count++ % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+inline void
+work(u64 n)
+{
+	for (u64 k = 0; k < n; ++k)
+		NOP;
+}
+
+/* Seconds since m was created */
+inline double
+since(const msg &m)
+{
+	clk::duration d(clk::now().time_since_epoch().count() - m.start);
+	return std::chrono::duration<double>(d).count();
+}
+
+/* Sends cfg.messages messages, timestamped as they are created */
+flow::input_node<msg>
+source(flow::graph &g, const config &cfg, u64 &next)
+{
+	return flow::input_node<msg>(g,
+			[&] (oneapi::tbb::flow_control &fc) -> msg {
+		if (next == cfg.messages) {
+			fc.stop();
+			return msg();
+		}
+		return {next++, clk::now().time_since_epoch().count()};
+	});
+}
+
+std::vector<std::unique_ptr<stage>>
+stages(flow::graph &g, const config &cfg, unsigned n)
+{
+	std::vector<std::unique_ptr<stage>> v;
+	for (unsigned k = 0; k < n; ++k)
+		v.emplace_back(new stage(g, cfg.concurrency, [&] (msg m) {
+			work(cfg.work);
+			return m;
+		}));
+	return v;
+}
+
+/* The graphs. Each one fills latencies (one per message) and returns the
+ * number of function_nodes a message goes through.
+ */
+unsigned
+chain(const config &cfg, std::vector<double> &latencies, bool limited)
+{
+	flow::graph g;
+	u64 next = 0;
+	auto in = source(g, cfg, next);
+	auto v = stages(g, cfg, cfg.nodes);
+	flow::limiter_node<msg> limiter(g, cfg.limit);
+	flow::function_node<msg, flow::continue_msg> sink(g, flow::unlimited,
+			[&] (msg m) {
+		latencies[m.i] = since(m);
+		return flow::continue_msg();
+	});
+
+	if (limited) {
+		flow::make_edge(in, limiter);
+		flow::make_edge(limiter, *v.front());
+		flow::make_edge(sink, limiter.decrementer());
+	} else {
+		flow::make_edge(in, *v.front());
+	}
+	for (unsigned k = 1; k < v.size(); ++k)
+		flow::make_edge(*v[k - 1], *v[k]);
+	flow::make_edge(*v.back(), sink);
+	in.activate();
+	g.wait_for_all();
+	return cfg.nodes;
+}
+
+unsigned
+broadcast(const config &cfg, std::vector<double> &latencies)
+{
+	flow::graph g;
+	u64 next = 0;
+	auto in = source(g, cfg, next);
+	flow::broadcast_node<msg> fan(g);
+	auto v = stages(g, cfg, cfg.nodes);
+	std::vector<std::atomic<unsigned>> remaining(cfg.messages);
+	flow::function_node<msg> sink(g, flow::unlimited, [&] (msg m) {
+		if (remaining[m.i].fetch_add(1) + 1 == cfg.nodes)
+			latencies[m.i] = since(m);
+	});
+
+	for (auto &r : remaining)
+		r = 0;
+	flow::make_edge(in, fan);
+	for (auto &s : v) {
+		flow::make_edge(fan, *s);
+		flow::make_edge(*s, sink);
+	}
+	in.activate();
+	g.wait_for_all();
+	return cfg.nodes;
+}
+
+unsigned
+join(const config &cfg, std::vector<double> &latencies)
+{
+	typedef std::tuple<msg, msg> pair;
+	flow::graph g;
+	u64 next = 0;
+	auto in = source(g, cfg, next);
+	flow::broadcast_node<msg> fan(g);
+	auto v = stages(g, cfg, 2);
+	auto key = [] (const msg &m) {return m.i;};
+	flow::join_node<pair, flow::key_matching<u64>> joined(g, key, key);
+	flow::function_node<pair> sink(g, flow::unlimited, [&] (pair p) {
+		latencies[std::get<0>(p).i] = since(std::get<0>(p));
+	});
+
+	flow::make_edge(in, fan);
+	flow::make_edge(fan, *v[0]);
+	flow::make_edge(fan, *v[1]);
+	flow::make_edge(*v[0], flow::input_port<0>(joined));
+	flow::make_edge(*v[1], flow::input_port<1>(joined));
+	flow::make_edge(joined, sink);
+	in.activate();
+	g.wait_for_all();
+	return 2;
+}
+
+unsigned
+task_group_chain(const config &cfg, std::vector<double> &latencies)
+{
+	oneapi::tbb::task_group g;
+	std::function<void(msg, unsigned)> run = [&] (msg m, unsigned k) {
+		work(cfg.work);
+		if (k + 1 == cfg.nodes)
+			latencies[m.i] = since(m);
+		else
+			g.run([&, m, k] {run(m, k + 1);});
+	};
+	for (u64 i = 0; i < cfg.messages; ++i) {
+		msg m = {i, clk::now().time_since_epoch().count()};
+		g.run([&, m] {run(m, 0);});
+	}
+	g.wait();
+	return cfg.nodes;
+}
+
+unsigned
+task_group_broadcast(const config &cfg, std::vector<double> &latencies)
+{
+	oneapi::tbb::task_group g;
+	std::vector<std::atomic<unsigned>> remaining(cfg.messages);
+	for (auto &r : remaining)
+		r = 0;
+	for (u64 i = 0; i < cfg.messages; ++i) {
+		msg m = {i, clk::now().time_since_epoch().count()};
+		for (unsigned k = 0; k < cfg.nodes; ++k) {
+			g.run([&, m] {
+				work(cfg.work);
+				if (remaining[m.i].fetch_add(1) + 1 == cfg.nodes)
+					latencies[m.i] = since(m);
+			});
+		}
+	}
+	g.wait();
+	return cfg.nodes;
+}
+
+/* p in [0, 1] of sorted v */
+double
+percentile(const std::vector<double> &v, double p)
+{
+	return v.empty() ? 0 : v[(size_t)(p * (v.size() - 1))];
+}
+
+/* Runs graph in arena and reports on it */
+template <typename Graph>
+void
+measure(const char *name, oneapi::tbb::task_arena &arena, const config &cfg,
+		Graph graph)
+{
+	std::vector<double> latencies(cfg.messages);
+	unsigned nodes;
+	auto start = std::chrono::high_resolution_clock::now();
+	arena.execute([&] {nodes = graph(latencies);});
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	double time = diff.count();
+	std::sort(latencies.begin(), latencies.end());
+
+	std::cout << name << tab;
+	std::cout << cfg.threads << tab;
+	std::cout << cfg.messages << tab;
+	std::cout << nodes << tab;
+	std::cout << time << tab;
+	std::cout << (double)cfg.messages / time << tab;
+	std::cout << time * 1e9 / cfg.messages / nodes << tab;
+	std::cout << percentile(latencies, 0.5) << tab;
+	std::cout << percentile(latencies, 0.99) << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	config cfg = {0, 0, 4, flow::unlimited, 0, 0};
+	size_t limit = 0; /* 0 → 4 * threads */
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:C:W:l:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		case 'n':
+			cfg.nodes = std::atoi(optarg);
+			break;
+		case 'C':
+			cfg.concurrency = std::atoi(optarg);
+			if (cfg.concurrency == 0)
+				cfg.concurrency = flow::unlimited;
+			break;
+		case 'W':
+			cfg.work = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 'l':
+			limit = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				" [-n nodes] [-C concurrency] [-W work]"
+				" [-l limit]" << std::endl;
+			return 1;
+		}
+	}
+	if (count < 1 || cfg.nodes < 1) {
+		std::cerr << "count and nodes must be >= 1" << std::endl;
+		return 1;
+	}
+
+	while (std::cin >> cfg.threads >> cfg.messages) {
+		if (cfg.threads < 1 || cfg.messages < 1) {
+			std::cerr << "Threads and messages must be >= 1"
+				<< std::endl;
+			continue;
+		}
+		cfg.limit = limit > 0 ? limit : 4 * cfg.threads;
+		oneapi::tbb::task_arena arena(cfg.threads);
+		pinning_observer observer(arena);
+		arena.initialize();
+
+		for (int i = 0; i < count; i++) {
+			measure("chain", arena, cfg, [&] (std::vector<double> &l) {
+				return chain(cfg, l, false);
+			});
+			measure("broadcast", arena, cfg,
+					[&] (std::vector<double> &l) {
+				return broadcast(cfg, l);
+			});
+			measure("join", arena, cfg, [&] (std::vector<double> &l) {
+				return join(cfg, l);
+			});
+			measure("limiter", arena, cfg,
+					[&] (std::vector<double> &l) {
+				return chain(cfg, l, true);
+			});
+			measure("task_group_chain", arena, cfg,
+					[&] (std::vector<double> &l) {
+				return task_group_chain(cfg, l);
+			});
+			measure("task_group_broadcast", arena, cfg,
+					[&] (std::vector<double> &l) {
+				return task_group_broadcast(cfg, l);
+			});
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
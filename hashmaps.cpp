@@ -0,0 +1,551 @@
+/* Throughput of concurrent hash maps
+ *
+ * usage: ./hashmaps [-c count] [-s stripes]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <iterations> <keys>
+ *
+ * For each line, threads threads pinned round-robin to the hardware threads
+ * perform iterations operations between them on a map from integer keys to
+ * integer values, which starts out holding every other one of keys keys.
+ * Operations are finds, inserts and erases, mixed in these proportions:
+ *
+ * 	read		100% finds
+ * 	read_mostly	90% finds, 10% inserts
+ * 	mixed		80% finds, 10% inserts, 10% erases
+ * 	write_heavy	50% finds, 25% inserts, 25% erases
+ *
+ * with keys drawn from a uniform or a Zipfian (s = 0.99) distribution. Keys
+ * and operations are generated before the clock starts. The maps are:
+ *
+ * 	concurrent_hash_map	tbb::concurrent_hash_map
+ * 	concurrent_unordered_map tbb::concurrent_unordered_map, which cannot
+ * 				erase concurrently and so only runs read
+ * 				and read_mostly
+ * 	striped-<lock>		stripes (default 64) std::unordered_maps, each
+ * 				protected by a lock of the types in mutexes
+ * 	open_addressing		lock-free linear probing (Preshing, 2013):
+ * 				keys are never removed, erasing a key clears
+ * 				its value instead
+ *
+ * Results are written to standard output with the following format:
+ *
+ * 	<map> <distribution> <mix> <threads> <iterations> <keys> <time>
+ * 	<ops/sec>
+ *
+ * Each line is ran count times (default 1).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <linux/futex.h>
+#include <mutex>
+#include <oneapi/tbb.h>
+#include <oneapi/tbb/concurrent_hash_map.h>
+#include <oneapi/tbb/concurrent_unordered_map.h>
+#include <oneapi/tbb/mutex.h>
+#include <random>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+typedef std::uint64_t u64;
+
+constexpr char tab = '\t';
+constexpr unsigned cache_line = 64;
+
+enum kind : unsigned char {
+	find,
+	insert,
+	erase,
+};
+
+struct operation {
+	u64 key;
+	kind what;
+};
+
+/* Percentages of finds and inserts, the rest being erases */
+struct mix {
+	const char *name;
+	unsigned finds, inserts;
+};
+
+const mix mixes[] = {
+	{"read", 100, 0},
+	{"read_mostly", 90, 10},
+	{"mixed", 80, 10},
+	{"write_heavy", 50, 25},
+};
+
+/* Where finds are sunk so they are not optimized away */
+std::atomic<u64> sink;
+
+/* The lock of mutexes' deque-atomic case */
+struct atomic_lock {
+	std::atomic<bool> locked {false};
+
+	void lock()
+	{
+		while (locked.exchange(true, std::memory_order_acquire))
+			;
+	}
+	void unlock() {locked.store(false, std::memory_order_release);}
+};
+
+/* mutexes' adaptive_mutex, without counting system calls */
+class adaptive_mutex {
+	/* 0 → unlocked, 1 → locked, 2 → locked with (possible) waiters */
+	std::atomic<int> state;
+	std::atomic<int> spins;
+	static constexpr int max_spins = 1000;
+
+	long futex(int op, int val);
+public:
+	adaptive_mutex() : state(0), spins(0) {}
+	void lock();
+	void unlock();
+};
+
+/* The maps. Every one is created for a number of keys and has find(k, v),
+ * insert(k, v) and erase(k). Keys are never 0.
+ */
+class chm_map {
+	oneapi::tbb::concurrent_hash_map<u64, u64> map;
+public:
+	chm_map(u64) {}
+	bool find(u64 k, u64 &v);
+	void insert(u64 k, u64 v);
+	void erase(u64 k) {map.erase(k);}
+};
+
+class cum_map {
+	oneapi::tbb::concurrent_unordered_map<u64, u64> map;
+public:
+	cum_map(u64 keys) : map(2 * keys) {}
+	bool find(u64 k, u64 &v);
+	void insert(u64 k, u64 v) {map.insert({k, v});}
+	void erase(u64) {std::abort();}
+};
+
+template <typename Mutex>
+struct alignas(cache_line) stripe {
+	Mutex lock;
+	std::unordered_map<u64, u64> map;
+};
+
+template <typename Mutex>
+class striped_map {
+	std::vector<stripe<Mutex>> stripes;
+
+	stripe<Mutex> &of(u64 k);
+public:
+	striped_map(u64 keys);
+	bool find(u64 k, u64 &v);
+	void insert(u64 k, u64 v);
+	void erase(u64 k);
+};
+
+class open_addressing_map {
+	struct slot {
+		std::atomic<u64> key;
+		std::atomic<u64> value; /* 0 → erased */
+	};
+	std::vector<slot> slots;
+	u64 mask;
+
+	slot *lookup(u64 k);
+public:
+	open_addressing_map(u64 keys);
+	bool find(u64 k, u64 &v);
+	void insert(u64 k, u64 v);
+	void erase(u64 k);
+};
+
+unsigned stripes = 64;
+
+void
+pin(unsigned cpu)
+{
+	unsigned nprocs = get_nprocs();
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(cpu % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+/* Scrambles the bits of k, which may be a small number (murmur3's finalizer) */
+inline u64
+mix64(u64 k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccd;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53;
+	k ^= k >> 33;
+	return k;
+}
+
+long
+adaptive_mutex::futex(int op, int val)
+{
+	return syscall(SYS_futex, reinterpret_cast<int *>(&state), op, val,
+			nullptr, nullptr, 0);
+}
+
+void
+adaptive_mutex::lock()
+{
+	int c = 0;
+	if (state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+		return;
+
+	int estimate = spins.load(std::memory_order_relaxed);
+	int limit = std::min(estimate * 2 + 10, max_spins);
+	int n;
+	for (n = 0; n < limit; ++n) {
+		c = 0;
+		if (state.load(std::memory_order_relaxed) == 0
+				&& state.compare_exchange_weak(c, 1,
+					std::memory_order_acquire))
+			break;
+		asm("pause");
+	}
+	spins.store(estimate + (n - estimate) / 8, std::memory_order_relaxed);
+	if (n < limit)
+		return;
+
+	while (state.exchange(2, std::memory_order_acquire) != 0)
+		futex(FUTEX_WAIT_PRIVATE, 2);
+}
+
+void
+adaptive_mutex::unlock()
+{
+	if (state.exchange(0, std::memory_order_release) == 2)
+		futex(FUTEX_WAKE_PRIVATE, 1);
+}
+
+bool
+chm_map::find(u64 k, u64 &v)
+{
+	oneapi::tbb::concurrent_hash_map<u64, u64>::const_accessor a;
+	if (!map.find(a, k))
+		return false;
+	v = a->second;
+	return true;
+}
+
+void
+chm_map::insert(u64 k, u64 v)
+{
+	oneapi::tbb::concurrent_hash_map<u64, u64>::accessor a;
+	map.insert(a, k);
+	a->second = v;
+}
+
+bool
+cum_map::find(u64 k, u64 &v)
+{
+	auto it = map.find(k);
+	if (it == map.end())
+		return false;
+	v = it->second;
+	return true;
+}
+
+template <typename Mutex>
+striped_map<Mutex>::striped_map(u64 keys) : stripes(::stripes)
+{
+	for (auto &s : stripes)
+		s.map.reserve(keys / ::stripes + 1);
+}
+
+template <typename Mutex>
+stripe<Mutex> &
+striped_map<Mutex>::of(u64 k)
+{
+	return stripes[mix64(k) % stripes.size()];
+}
+
+template <typename Mutex>
+bool
+striped_map<Mutex>::find(u64 k, u64 &v)
+{
+	auto &s = of(k);
+	std::lock_guard<Mutex> lock(s.lock);
+	auto it = s.map.find(k);
+	if (it == s.map.end())
+		return false;
+	v = it->second;
+	return true;
+}
+
+template <typename Mutex>
+void
+striped_map<Mutex>::insert(u64 k, u64 v)
+{
+	auto &s = of(k);
+	std::lock_guard<Mutex> lock(s.lock);
+	s.map[k] = v;
+}
+
+template <typename Mutex>
+void
+striped_map<Mutex>::erase(u64 k)
+{
+	auto &s = of(k);
+	std::lock_guard<Mutex> lock(s.lock);
+	s.map.erase(k);
+}
+
+/* Twice as many slots as keys, so probes stay short and it never fills */
+open_addressing_map::open_addressing_map(u64 keys)
+{
+	u64 capacity = 1;
+	while (capacity < 2 * keys)
+		capacity *= 2;
+	slots = std::vector<slot>(capacity);
+	mask = capacity - 1;
+	for (auto &s : slots) {
+		s.key = 0;
+		s.value = 0;
+	}
+}
+
+/* The slot holding k, claiming an empty one if it is not in the table */
+open_addressing_map::slot *
+open_addressing_map::lookup(u64 k)
+{
+	for (u64 i = mix64(k);; ++i) {
+		slot &s = slots[i & mask];
+		u64 found = s.key.load(std::memory_order_acquire);
+		if (found == k)
+			return &s;
+		if (found == 0 && s.key.compare_exchange_strong(found, k,
+					std::memory_order_acq_rel))
+			return &s;
+		/* Lost the race for the slot, maybe to another insert of k */
+		if (found == k)
+			return &s;
+	}
+}
+
+bool
+open_addressing_map::find(u64 k, u64 &v)
+{
+	for (u64 i = mix64(k);; ++i) {
+		slot &s = slots[i & mask];
+		u64 found = s.key.load(std::memory_order_acquire);
+		if (found == 0)
+			return false;
+		if (found == k) {
+			v = s.value.load(std::memory_order_acquire);
+			return v != 0;
+		}
+	}
+}
+
+void
+open_addressing_map::insert(u64 k, u64 v)
+{
+	lookup(k)->value.store(v, std::memory_order_release);
+}
+
+void
+open_addressing_map::erase(u64 k)
+{
+	u64 v;
+	/* Keys that were never inserted do not need a slot */
+	if (find(k, v))
+		lookup(k)->value.store(0, std::memory_order_release);
+}
+
+/* Draws from 1..keys, uniformly or with probability proportional to
+ * 1 / rank^0.99.
+ */
+class key_distribution {
+	std::vector<double> cdf;
+	std::uniform_int_distribution<u64> uniform;
+public:
+	key_distribution(u64 keys, bool zipf);
+	u64 operator()(std::mt19937_64 &rng);
+};
+
+key_distribution::key_distribution(u64 keys, bool zipf) : uniform(1, keys)
+{
+	if (!zipf)
+		return;
+	cdf.resize(keys);
+	double sum = 0;
+	for (u64 r = 0; r < keys; ++r)
+		cdf[r] = sum += 1 / std::pow(r + 1, 0.99);
+	for (auto &c : cdf)
+		c /= sum;
+}
+
+u64
+key_distribution::operator()(std::mt19937_64 &rng)
+{
+	if (cdf.empty())
+		return uniform(rng);
+	double u = std::uniform_real_distribution<double>(0, 1)(rng);
+	auto it = std::lower_bound(cdf.begin(), cdf.end(), u);
+	return std::min<u64>(it - cdf.begin(), cdf.size() - 1) + 1;
+}
+
+template <typename Map>
+void
+run(const char *name, const char *dist,
+		const std::vector<std::vector<operation>> &ops, const mix &m,
+		u64 iterations, u64 keys)
+{
+	const unsigned nthreads = ops.size();
+	Map map(keys);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> go(false);
+
+	for (u64 k = 1; k <= keys; k += 2)
+		map.insert(k, k);
+	for (unsigned t = 0; t < nthreads; ++t) {
+		threads.emplace_back([&, t] {
+			pin(t);
+			u64 found = 0, v;
+			ready++;
+			while (!go)
+				;
+			for (auto &op : ops[t]) {
+				switch (op.what) {
+				case find:
+					if (map.find(op.key, v))
+						found += v;
+					break;
+				case insert:
+					map.insert(op.key, op.key);
+					break;
+				case erase:
+					map.erase(op.key);
+					break;
+				}
+			}
+			sink.fetch_add(found, std::memory_order_relaxed);
+		});
+	}
+	while (ready != nthreads)
+		;
+	auto start = std::chrono::high_resolution_clock::now();
+	go = true;
+	for (auto &t : threads)
+		t.join();
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	double time = diff.count();
+
+	std::cout << name << tab;
+	std::cout << dist << tab;
+	std::cout << m.name << tab;
+	std::cout << nthreads << tab;
+	std::cout << iterations << tab;
+	std::cout << keys << tab;
+	std::cout << time << tab;
+	std::cout << (double)iterations / time << std::endl;
+}
+
+/* Every map on the same operations */
+void
+run_maps(const char *dist, const std::vector<std::vector<operation>> &ops,
+		const mix &m, u64 iterations, u64 keys)
+{
+	run<chm_map>("concurrent_hash_map", dist, ops, m, iterations, keys);
+	if (m.finds + m.inserts == 100)
+		run<cum_map>("concurrent_unordered_map", dist, ops, m,
+				iterations, keys);
+	run<striped_map<std::mutex>>("striped-mutex", dist, ops, m,
+			iterations, keys);
+	run<striped_map<atomic_lock>>("striped-atomic", dist, ops, m,
+			iterations, keys);
+	run<striped_map<oneapi::tbb::spin_mutex>>("striped-spin_mutex", dist,
+			ops, m, iterations, keys);
+	run<striped_map<oneapi::tbb::v1::mutex>>("striped-v1_mutex", dist,
+			ops, m, iterations, keys);
+	run<striped_map<adaptive_mutex>>("striped-adaptive_mutex", dist, ops,
+			m, iterations, keys);
+	run<open_addressing_map>("open_addressing", dist, ops, m, iterations,
+			keys);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:s:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		case 's':
+			stripes = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0]
+				<< " [-c count] [-s stripes]" << std::endl;
+			return 1;
+		}
+	}
+	if (count < 1 || stripes < 1) {
+		std::cerr << "count and stripes must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	u64 iterations;
+	u64 keys;
+
+	while (std::cin >> threads >> iterations >> keys) {
+		if (threads < 1 || keys < 1) {
+			std::cerr << "Threads and keys must be >= 1" << std::endl;
+			continue;
+		}
+		for (bool zipf : {false, true}) {
+			key_distribution draw(keys, zipf);
+			const char *dist = zipf ? "zipf" : "uniform";
+			for (auto &m : mixes) {
+				std::vector<std::vector<operation>> ops(threads);
+				for (int t = 0; t < threads; ++t) {
+					std::mt19937_64 rng(t);
+					u64 n = iterations / threads
+						+ ((u64)t < iterations % threads);
+					for (u64 i = 0; i < n; ++i) {
+						unsigned p = rng() % 100;
+						kind what = p < m.finds ? find
+							: p < m.finds + m.inserts
+							? insert : erase;
+						ops[t].push_back({draw(rng), what});
+					}
+				}
+				for (int i = 0; i < count; i++)
+					run_maps(dist, ops, m, iterations, keys);
+			}
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
@@ -1,13 +1,172 @@
+/* Cost of the locks provided by the standard library and TBB
+ *
+ * usage: ./mutexes [-a ncpus] [-t threads | -O factor] [-i cs_work]
+ * 		[-o noncs_work] [-m] [-s] [-k shards [-H] | -l | -C]
+ * 		<n_iterations>
+ *        ./mutexes -p auto|<cpu>,<cpu> [-i cs_work] <n_samples>
+ *        ./mutexes -P <producers>,<consumers> [-o noncs_work] <n_items>
+ *        ./mutexes -f processes [-i cs_work] [-o noncs_work] [-m] [-s]
+ *        	<n_iterations>
+ *
+ * Without -t, every lock protects a std::deque in a single thread: the deque
+ * is pushed to n_iterations times and then popped from n_iterations times.
+ * Results are written to standard output as comma-separated values:
+ *
+ * 	<case>,<iterations>,<push_time>,<push/sec>,<pop_time>,<pop/sec>
+ *
+ * With -t, threads threads share the deque and the lock instead, and perform
+ * n_iterations acquisitions between them, alternating between pushing and
+ * popping. Each acquisition does cs_work units of work while holding the lock
+ * and noncs_work units of work after releasing it (both 0 by default). A unit
+ * of work is a NOP, or with -m, a write to a cache line (of a buffer shared
+ * between threads inside the critical section, or of a private buffer outside
+ * of it). Results are written as:
+ *
+ * 	<case>,<threads>,<iterations>,<cs_work>,<noncs_work>,<time>,<acq/sec>
+ *
+ * With -s, cs_work and noncs_work are the upper bounds of a sweep over 0 and
+ * the powers of 4 up to them, and every combination is measured.
+ *
+ * With -C, every lock type protects each of these containers instead of the
+ * deque (<container>-<lock>), all created with n_iterations elements and room
+ * for as many more:
+ *
+ * 	ring		ring buffer with a power of two capacity, whose indices
+ * 			are masked
+ * 	circular	circular buffer in a std::vector, whose indices wrap
+ * 			around with a comparison
+ * 	list		std::list which takes its nodes from, and returns them
+ * 			to, a spare list instead of allocating them
+ * 	deque		std::deque, as without -C
+ *
+ * Without -t, <container>-nothing rows give the cost of the container alone,
+ * which can be subtracted from the other rows to get the cost of the lock.
+ *
+ * deque-adaptive_mutex uses adaptive_mutex, a spin-then-park mutex built on
+ * Linux futexes. In contended mode its row has an extra column with the
+ * number of futex system calls it made per thousand acquisitions. Low, medium
+ * and oversubscribed contention can be compared by running with -t 2, -t
+ * $(nproc) and -t $((2 * $(nproc))).
+ *
+ * In contended mode, the deque is also accessed through two combining
+ * techniques that do not hand a lock over between threads: flat combining
+ * (deque-flat_combining), where whichever thread takes the lock performs the
+ * operations published by all the others, and delegation
+ * (deque-delegation), where a dedicated server thread performs all of them.
+ *
+ * With -k, the single deque is replaced by a striped one for every lock type
+ * (striped-<lock>): K deques, each with its own lock and its own buffer for
+ * critical section work, where K goes over the powers of 2 up to shards. Each
+ * thread pushes to and pops from shard t % K, or with -H, a shard picked by
+ * hashing the thread and iteration numbers. Pops from an empty shard steal
+ * from the next non-empty one. Results have three extra columns:
+ *
+ * 	<K>,<affine|hashed>,<steals/1000 acq>
+ *
+ * With -l, the deque is replaced by a counter, and every lock type is run
+ * with the lock and its counter laid out in memory in each of these ways
+ * (placed-<lock>, with the layout in an extra column):
+ *
+ * 	colocated	lock and counter in the same cache line
+ * 	padded		lock alone in its line, counter in the next one
+ * 	separate	lock and counter a page apart
+ * 	packed		one lock and counter per thread, with all the locks
+ * 			packed into as few lines as possible
+ * 	private		one lock and counter per thread, each in its own line
+ *
+ * In packed and private, threads only ever take their own lock, so any
+ * difference between the two is false sharing between lock words.
+ *
+ * -a restricts the process to the first ncpus CPUs it is allowed to run on.
+ * With -O, every lock type (oversubscribed-<lock>) is run by 1, 2, 4, ... up
+ * to factor times as many threads as there are allowed CPUs, to show how
+ * throughput collapses when lock holders get preempted. Each acquisition is
+ * timed, and results have extra columns with the number of allowed CPUs and
+ * the distribution of the time it took to acquire the lock, in seconds:
+ *
+ * 	<cpus>,<p50>,<p99>,<p99.9>,<max>
+ *
+ * With -p, two threads pinned to a pair of CPUs pass every lock type back and
+ * forth n_samples times, measuring handoff latency: the time from one thread
+ * releasing the lock (which it holds for cs_work units of work after the other
+ * thread starts waiting for it) until the other thread has acquired it. With
+ * -p auto, the pairs are CPU 0 and its SMT sibling (smt), another core in the
+ * same package (socket) and a core in another package (cross), for those that
+ * exist. Results are written as:
+ *
+ * 	<case>,<cpu>,<cpu>,<pair>,<samples>,<min>,<p50>,<p90>,<p99>,<max>
+ *
+ * With -P, producers and consumers run concurrently: producers push n_items
+ * timestamped items between them, doing noncs_work units of work before each
+ * one, while consumers pop them. Consumers wait for items in one of these
+ * ways:
+ *
+ * 	condvar		std::deque and std::mutex, std::condition_variable
+ * 	bounded_queue	tbb::concurrent_bounded_queue, which blocks in pop()
+ * 	eventcount	std::deque and std::mutex, futex-based eventcount
+ * 	busy_poll	std::deque and tbb::spin_mutex, retrying until not empty
+ *
+ * Results are written as:
+ *
+ * 	<case>,<producers>,<consumers>,<items>,<time>,<items/sec>,<p50>,<p99>,
+ * 	<max>
+ *
+ * Where the last three columns describe the time from pushing an item until
+ * it was popped, in seconds.
+ *
+ * -P also runs two lock-free structures, whose consumers busy-poll:
+ * Treiber's stack (treiber-<reclaim>) and Michael and Scott's queue
+ * (msqueue-<reclaim>). Popped nodes are freed by one of these memory
+ * reclamation schemes:
+ *
+ * 	hazard		hazard pointers (Michael, 2004)
+ * 	epoch		epoch-based reclamation (Fraser, 2004)
+ * 	leak		nothing is freed until the run is over
+ *
+ * Their rows have an extra column with the largest number of bytes of nodes
+ * that were allocated and not yet freed, sampled before each batch of retired
+ * nodes is freed and at the end of the run.
+ *
+ * With -f, processes processes are forked instead of threads being started,
+ * and the lock, a ring buffer that stands in for the deque and the critical
+ * section's buffer live in a shared memory object (shm_open and mmap).
+ * Results are written like with -t, with processes in place of threads, for
+ * these locks (shm-<lock>):
+ *
+ * 	pthread_mutex	pthread mutex with PTHREAD_PROCESS_SHARED
+ * 	robust_mutex	the same, also PTHREAD_MUTEX_ROBUST
+ * 	futex		Drepper's mutex3 on shared (not private) futexes
+ * 	atomic		the spin lock of deque-atomic
+ */
+
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <climits>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <linux/futex.h>
+#include <list>
 #include <mutex>
+#include <new>
 #include <oneapi/tbb.h>
 #include <oneapi/tbb/mutex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #ifdef DEBUG
 #define debug(str) std::cerr << str << std::endl;
@@ -37,37 +196,2058 @@
 	});\
 	std::cout << result << ",";\
 	std::cout << ((double)its / result) << std::endl;}
+/* Contended version of SEQ, see contended() */
+#define PAR(name, lock, unlock, push, pop, its) \
+	contended(name, [&] (unsigned, auto &&f) {lock; f(); unlock;}, \
+			[&] (u64 i) {push;}, [&] {pop;}, its)
+/* PAR which also reports the syscalls counted by the std::atomic<u64> sys */
+#define PAR_SYS(name, lock, unlock, push, pop, its, sys) \
+	contended(name, [&] (unsigned, auto &&f) {lock; f(); unlock;}, \
+			[&] (u64 i) {push;}, [&] {pop;}, its, &sys)
+/* PAR where exec runs the critical section f on behalf of thread t */
+#define PAR_VIA(name, exec, push, pop, its) \
+	contended(name, [&] (unsigned t, auto &&f) {exec;}, \
+			[&] (u64 i) {push;}, [&] {pop;}, its)
 
 
 typedef std::uint64_t u64;
 
+constexpr unsigned cache_line = 64;
+
+struct options {
+	unsigned threads; /* 0 → single-threaded */
+	u64 cs_work, noncs_work;
+	bool memory; /* work touches cache lines instead of being NOPs */
+	bool sweep;
+	unsigned shards; /* 0 → not striped */
+	bool hashed; /* shard selection */
+	bool layouts;
+	unsigned oversubscribe; /* 0 → threads is given by -t */
+	bool containers;
+	unsigned processes; /* 0 → threads, not processes */
+};
+
+/* Two CPUs to ping-pong between, and how they are related */
+struct cpu_pair {
+	unsigned a, b;
+	std::string label;
+};
+
+enum layout {
+	colocated,
+	padded,
+	separate,
+	packed,
+	private_,
+};
+
+const char *layout_names[] = {
+	"colocated", "padded", "separate", "packed", "private",
+};
+
+/* Spins for a bounded number of iterations and then parks on a futex. The
+ * bound adapts like glibc's PTHREAD_MUTEX_ADAPTIVE_NP: it is a moving average
+ * of how long recent acquisitions had to spin, so that locks which are
+ * usually released quickly are spun on and the others are slept on. Parking
+ * follows Drepper's "Futexes Are Tricky" (mutex3).
+ */
+class adaptive_mutex {
+	/* 0 → unlocked, 1 → locked, 2 → locked with (possible) waiters */
+	std::atomic<int> state;
+	std::atomic<int> spins;
+	static constexpr int max_spins = 1000;
+
+	long futex(int op, int val);
+public:
+	std::atomic<u64> futex_calls;
+
+	adaptive_mutex() : state(0), spins(0), futex_calls(0) {}
+	void lock();
+	void unlock();
+};
+
+/* A published critical section, one per thread. fn is null when there is
+ * nothing to do (anymore).
+ */
+struct alignas(cache_line) request {
+	std::atomic<void (*)(void *)> fn;
+	void *arg;
+
+	request() : fn(nullptr), arg(nullptr) {}
+	template <typename F> void publish(F &f);
+};
+
+/* A lock and the deque it protects, which has its own buffer for critical
+ * section work. Aligned so that neighbouring shards do not share lines.
+ */
+template <typename Mutex>
+struct alignas(cache_line) shard {
+	Mutex lock;
+	std::deque<int> deque;
+	std::vector<std::atomic<unsigned char>> data;
+};
+
+/* Keeps v from being optimized away */
+inline void
+keep(int v)
+{
+	asm volatile("" : : "r"(v));
+}
+
+/* Containers for -C, FIFOs of ints like the deque is used as. Each is
+ * created holding n elements with room for n more.
+ */
+class ring_buffer {
+	std::vector<int> slots;
+	u64 mask, head, tail;
+public:
+	ring_buffer(u64 n);
+	void push(int v) {slots[head++ & mask] = v;}
+	int pop() {return slots[tail++ & mask];}
+};
+
+class circular_buffer {
+	std::vector<int> slots;
+	u64 head, tail;
+public:
+	circular_buffer(u64 n) : slots(2 * n + 1), head(n), tail(0) {}
+	void push(int v);
+	int pop();
+};
+
+class pooled_list {
+	std::list<int> items, spare;
+public:
+	pooled_list(u64 n) : items(n), spare(n) {}
+	void push(int v);
+	int pop();
+};
+
+struct deque_container {
+	std::deque<int> deque;
+
+	deque_container(u64 n) : deque(n) {}
+	void push(int v) {deque.push_front(v);}
+	int pop() {int v = deque.back(); deque.pop_back(); return v;}
+};
+
+/* The lock of the deque-atomic case, for templates over lock types */
+struct atomic_lock {
+	std::atomic<bool> locked {false};
+
+	void lock()
+	{
+		while (locked.exchange(true, std::memory_order_acquire))
+			;
+	}
+	void unlock() {locked.store(false, std::memory_order_release);}
+};
+
+/* Locks for -f, which work between processes */
+class pshared_mutex {
+	pthread_mutex_t mutex;
+public:
+	pshared_mutex(bool robust = false);
+	~pshared_mutex() {pthread_mutex_destroy(&mutex);}
+	void lock();
+	void unlock() {pthread_mutex_unlock(&mutex);}
+};
+
+struct robust_mutex : pshared_mutex {
+	robust_mutex() : pshared_mutex(true) {}
+};
+
+/* Drepper's mutex3, on futexes that are not private to the process */
+class shared_futex_mutex {
+	/* 0 → unlocked, 1 → locked, 2 → locked with (possible) waiters */
+	std::atomic<int> state {0};
+public:
+	void lock();
+	void unlock();
+};
+
+/* Lets threads sleep until an event happens after they decided to wait,
+ * without holding a lock (Vyukov's eventcount, on a futex). A waiter calls
+ * prepare_wait(), checks its condition once more and then either
+ * cancel_wait()s or wait()s; notifiers make the condition true first.
+ */
+class eventcount {
+	std::atomic<int> epoch;
+	std::atomic<int> waiters;
+public:
+	eventcount() : epoch(0), waiters(0) {}
+	int prepare_wait();
+	void cancel_wait();
+	void wait(int key);
+	void notify_one();
+};
+
+/* Item queues for -P. pop() blocks until there is something to return. */
+struct condvar_queue {
+	std::mutex mutex;
+	std::condition_variable nonempty;
+	std::deque<u64> items;
+
+	void push(u64 item);
+	u64 pop();
+};
+
+struct bounded_queue {
+	oneapi::tbb::concurrent_bounded_queue<u64> items;
+
+	void push(u64 item) {items.push(item);}
+	u64 pop() {u64 item = 0; items.pop(item); return item;}
+};
+
+struct eventcount_queue {
+	std::mutex mutex;
+	eventcount ec;
+	std::deque<u64> items;
+
+	bool try_pop(u64 &item);
+	void push(u64 item);
+	u64 pop();
+};
+
+struct busy_poll_queue {
+	oneapi::tbb::spin_mutex mutex;
+	std::deque<u64> items;
+
+	void push(u64 item);
+	u64 pop();
+};
+
+/* A node of the lock-free structures for -P */
+struct lf_node {
+	u64 value;
+	std::atomic<lf_node *> next;
+};
+
+/* A thread's state in a reclamation domain: its hazard pointers, its epoch
+ * ((epoch << 1) | 1 during an operation, 0 outside of one), the nodes it
+ * retired, with the epoch they were retired in, and how many nodes it
+ * allocated and freed. The counts are only written by their thread, on a
+ * line of their own so that scans of the others do not contend with them.
+ */
+struct alignas(cache_line) reclaim_record {
+	std::atomic<lf_node *> hazards[2];
+	std::atomic<u64> epoch;
+	std::vector<std::pair<lf_node *, u64>> retired;
+	alignas(cache_line) std::atomic<u64> allocated;
+	std::atomic<u64> freed;
+
+	reclaim_record() :
+		hazards{nullptr, nullptr}, epoch(0), allocated(0), freed(0) {}
+};
+
+/* Allocates and frees the nodes of one structure, counting them per thread.
+ * Threads claim a record on first use. Reclamation schemes derive from it
+ * and provide guard, which is held during every operation and protect()s
+ * pointers before they are dereferenced, and retire(), which frees a node
+ * once no guard can reach it anymore. The peak number of live nodes is
+ * sampled when retired nodes are about to be freed, which is when the most
+ * of them are waiting, and once more at the end.
+ */
+class reclaim_domain {
+	static std::atomic<u64> generations;
+	const u64 generation;
+	std::atomic<u64> peak;
+protected:
+	static constexpr unsigned max_records = 256;
+	std::vector<reclaim_record> records;
+	std::atomic<unsigned> nrecords;
+
+	reclaim_record &local();
+	u64 live() const;
+	void sample();
+public:
+	reclaim_domain();
+	~reclaim_domain();
+	lf_node *alloc(u64 value);
+	void free(lf_node *n);
+	u64 peak_nodes() const {return std::max<u64>(peak, live());}
+};
+
+std::atomic<u64> reclaim_domain::generations(0);
+
+struct leak_reclaim : reclaim_domain {
+	struct guard {
+		guard(leak_reclaim &) {}
+		lf_node *protect(unsigned, std::atomic<lf_node *> &src)
+		{
+			return src.load(std::memory_order_acquire);
+		}
+	};
+	void retire(lf_node *n) {local().retired.emplace_back(n, 0);}
+};
+
+class hazard_reclaim : public reclaim_domain {
+	void scan(reclaim_record &r);
+public:
+	class guard {
+		reclaim_record &r;
+	public:
+		guard(hazard_reclaim &d) : r(d.local()) {}
+		~guard();
+		lf_node *protect(unsigned i, std::atomic<lf_node *> &src);
+	};
+	void retire(lf_node *n);
+};
+
+class epoch_reclaim : public reclaim_domain {
+	std::atomic<u64> global;
+	void collect(reclaim_record &r);
+public:
+	class guard {
+		reclaim_record &r;
+	public:
+		guard(epoch_reclaim &d);
+		~guard() {r.epoch.store(0, std::memory_order_release);}
+		lf_node *protect(unsigned, std::atomic<lf_node *> &src)
+		{
+			return src.load(std::memory_order_acquire);
+		}
+	};
+	epoch_reclaim() : global(0) {}
+	void retire(lf_node *n);
+};
+
+template <typename Reclaim>
+class treiber_stack {
+	Reclaim reclaim;
+	alignas(cache_line) std::atomic<lf_node *> top;
+public:
+	treiber_stack() : top(nullptr) {}
+	~treiber_stack();
+	void push(u64 item);
+	bool try_pop(u64 &item);
+	u64 pop();
+	u64 peak_nodes() const {return reclaim.peak_nodes();}
+};
+
+template <typename Reclaim>
+class ms_queue {
+	Reclaim reclaim;
+	alignas(cache_line) std::atomic<lf_node *> head;
+	alignas(cache_line) std::atomic<lf_node *> tail;
+public:
+	ms_queue();
+	~ms_queue();
+	void push(u64 item);
+	bool try_pop(u64 &item);
+	u64 pop();
+	u64 peak_nodes() const {return reclaim.peak_nodes();}
+};
+
+/* Flat combining (Hendler et al., 2010): threads publish their critical
+ * sections, and whichever one gets the lock runs all published sections
+ * before releasing it, so the protected data stays in one cache.
+ */
+class flat_combiner {
+	std::vector<request> requests;
+	std::atomic<bool> locked;
+public:
+	flat_combiner(unsigned nthreads) : requests(nthreads), locked(false) {}
+	template <typename F> void apply(unsigned t, F &&f);
+};
+
+/* Delegation: a server thread runs every published critical section, so
+ * clients never touch the protected data at all.
+ */
+class delegation_server {
+	std::vector<request> requests;
+	std::atomic<bool> stop;
+	std::thread server;
+public:
+	delegation_server(unsigned nthreads);
+	~delegation_server();
+	template <typename F> void apply(unsigned t, F &&f);
+};
+
 const char *progname;
+const char *usage = "[-a ncpus] [-t threads | -O factor] [-i cs_work]"
+	" [-o noncs_work] [-m] [-s] [-k shards [-H] | -l | -C] <n_iterations>\n"
+	"       [-i cs_work] -p auto|<cpu>,<cpu> <n_samples>\n"
+	"       [-o noncs_work] -P <producers>,<consumers> <n_items>\n"
+	"       -f processes [-i cs_work] [-o noncs_work] [-m] [-s]"
+	" <n_iterations>";
+options opts;
+std::vector<cpu_pair> pairs; /* -p */
+unsigned producers, consumers; /* -P */
+
+template <typename F>
+void
+request::publish(F &f)
+{
+	arg = &f;
+	fn.store([] (void *p) {(*static_cast<F *>(p))();},
+			std::memory_order_release);
+}
+
+template <typename F>
+void
+flat_combiner::apply(unsigned t, F &&f)
+{
+	request &own = requests[t];
+	own.publish(f);
+	for (;;) {
+		if (!locked.load(std::memory_order_relaxed)
+				&& !locked.exchange(true, std::memory_order_acquire)) {
+			for (auto &r : requests) {
+				auto fn = r.fn.load(std::memory_order_acquire);
+				if (fn == nullptr)
+					continue;
+				fn(r.arg);
+				r.fn.store(nullptr, std::memory_order_release);
+			}
+			locked.store(false, std::memory_order_release);
+		}
+		if (own.fn.load(std::memory_order_acquire) == nullptr)
+			return;
+		asm("pause");
+	}
+}
+
+delegation_server::delegation_server(unsigned nthreads)
+	: requests(nthreads), stop(false)
+{
+	server = std::thread([this] {
+		while (!stop.load(std::memory_order_relaxed)) {
+			bool idle = true;
+			for (auto &r : requests) {
+				auto fn = r.fn.load(std::memory_order_acquire);
+				if (fn == nullptr)
+					continue;
+				fn(r.arg);
+				r.fn.store(nullptr, std::memory_order_release);
+				idle = false;
+			}
+			/* Let clients run if we are sharing their core */
+			if (idle)
+				sched_yield();
+		}
+	});
+}
+
+delegation_server::~delegation_server()
+{
+	stop = true;
+	server.join();
+}
+
+template <typename F>
+void
+delegation_server::apply(unsigned t, F &&f)
+{
+	request &own = requests[t];
+	own.publish(f);
+	for (unsigned spins = 0;
+			own.fn.load(std::memory_order_acquire) != nullptr;
+			++spins) {
+		if (spins < 1000)
+			asm("pause");
+		else
+			sched_yield();
+	}
+}
+
+ring_buffer::ring_buffer(u64 n) : head(n), tail(0)
+{
+	u64 capacity = 1;
+	while (capacity < 2 * n)
+		capacity *= 2;
+	slots.resize(capacity);
+	mask = capacity - 1;
+}
+
+void
+circular_buffer::push(int v)
+{
+	slots[head] = v;
+	if (++head == slots.size())
+		head = 0;
+}
+
+int
+circular_buffer::pop()
+{
+	int v = slots[tail];
+	if (++tail == slots.size())
+		tail = 0;
+	return v;
+}
+
+void
+pooled_list::push(int v)
+{
+	if (spare.empty()) {
+		items.push_front(v);
+		return;
+	}
+	items.splice(items.begin(), spare, spare.begin());
+	items.front() = v;
+}
+
+int
+pooled_list::pop()
+{
+	int v = items.back();
+	spare.splice(spare.begin(), items, std::prev(items.end()));
+	return v;
+}
+
+long
+futex(std::atomic<int> &word, int op, int val)
+{
+	return syscall(SYS_futex, reinterpret_cast<int *>(&word), op, val,
+			nullptr, nullptr, 0);
+}
+
+int
+eventcount::prepare_wait()
+{
+	waiters.fetch_add(1, std::memory_order_seq_cst);
+	return epoch.load(std::memory_order_seq_cst);
+}
+
+void
+eventcount::cancel_wait()
+{
+	waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void
+eventcount::wait(int key)
+{
+	while (epoch.load(std::memory_order_acquire) == key)
+		futex(epoch, FUTEX_WAIT_PRIVATE, key);
+	waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void
+eventcount::notify_one()
+{
+	/* Pairs with the seq_cst increment in prepare_wait(): either the
+	 * waiter sees our change to the condition or we see the waiter.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiters.load(std::memory_order_relaxed) == 0)
+		return;
+	epoch.fetch_add(1, std::memory_order_release);
+	futex(epoch, FUTEX_WAKE_PRIVATE, 1);
+}
+
+void
+condvar_queue::push(u64 item)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		items.push_back(item);
+	}
+	nonempty.notify_one();
+}
 
 u64
-parse_args(int argc, char *argv[])
+condvar_queue::pop()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	nonempty.wait(lock, [this] {return !items.empty();});
+	u64 item = items.front();
+	items.pop_front();
+	return item;
+}
+
+bool
+eventcount_queue::try_pop(u64 &item)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (items.empty())
+		return false;
+	item = items.front();
+	items.pop_front();
+	return true;
+}
+
+void
+eventcount_queue::push(u64 item)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		items.push_back(item);
+	}
+	ec.notify_one();
+}
+
+u64
+eventcount_queue::pop()
+{
+	u64 item;
+	while (!try_pop(item)) {
+		int key = ec.prepare_wait();
+		if (try_pop(item)) {
+			ec.cancel_wait();
+			break;
+		}
+		ec.wait(key);
+	}
+	return item;
+}
+
+void
+busy_poll_queue::push(u64 item)
+{
+	oneapi::tbb::spin_mutex::scoped_lock lock(mutex);
+	items.push_back(item);
+}
+
+u64
+busy_poll_queue::pop()
+{
+	for (;;) {
+		{
+			oneapi::tbb::spin_mutex::scoped_lock lock(mutex);
+			if (!items.empty()) {
+				u64 item = items.front();
+				items.pop_front();
+				return item;
+			}
+		}
+		asm("pause");
+	}
+}
+
+reclaim_domain::reclaim_domain() :
+		generation(++generations),
+		peak(0),
+		records(max_records),
+		nrecords(0)
+{
+}
+
+reclaim_domain::~reclaim_domain()
+{
+	for (auto &r : records)
+		for (auto &n : r.retired)
+			free(n.first);
+}
+
+reclaim_record &
+reclaim_domain::local()
+{
+	/* The cache below is shared by every domain a thread ever uses. The
+	 * generation tells domains apart even if one is allocated where a
+	 * previous one used to be, so a record from a freed domain is never
+	 * reused.
+	 */
+	thread_local u64 cached_generation = 0;
+	thread_local unsigned cached = 0;
+	if (cached_generation != generation) {
+		cached = nrecords++;
+		if (cached >= max_records)
+			DIE("more than " << max_records << " threads");
+		cached_generation = generation;
+	}
+	return records[cached];
+}
+
+/* Only approximate while other threads allocate and free */
+u64
+reclaim_domain::live() const
+{
+	u64 allocated = 0, freed = 0;
+	for (unsigned k = 0; k < nrecords && k < max_records; ++k) {
+		allocated += records[k].allocated.load(std::memory_order_relaxed);
+		freed += records[k].freed.load(std::memory_order_relaxed);
+	}
+	return allocated - freed;
+}
+
+void
+reclaim_domain::sample()
+{
+	u64 n = live();
+	u64 p = peak.load(std::memory_order_relaxed);
+	while (n > p && !peak.compare_exchange_weak(p, n,
+				std::memory_order_relaxed))
+		;
+}
+
+lf_node *
+reclaim_domain::alloc(u64 value)
+{
+	auto &c = local().allocated;
+	c.store(c.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	return new lf_node {value, {nullptr}};
+}
+
+void
+reclaim_domain::free(lf_node *n)
+{
+	auto &c = local().freed;
+	c.store(c.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+	delete n;
+}
+
+hazard_reclaim::guard::~guard()
+{
+	r.hazards[0].store(nullptr, std::memory_order_release);
+	r.hazards[1].store(nullptr, std::memory_order_release);
+}
+
+lf_node *
+hazard_reclaim::guard::protect(unsigned i, std::atomic<lf_node *> &src)
+{
+	/* Only safe to use once src is seen to still point to it after the
+	 * hazard pointer was published.
+	 */
+	lf_node *p = src.load(std::memory_order_acquire);
+	for (;;) {
+		r.hazards[i].store(p, std::memory_order_seq_cst);
+		lf_node *q = src.load(std::memory_order_seq_cst);
+		if (q == p)
+			return p;
+		p = q;
+	}
+}
+
+void
+hazard_reclaim::retire(lf_node *n)
+{
+	auto &r = local();
+	r.retired.emplace_back(n, 0);
+	/* Amortize scans: each one frees all but at most 2 * nrecords */
+	if (r.retired.size() >= 4 * nrecords + 64)
+		scan(r);
+}
+
+void
+hazard_reclaim::scan(reclaim_record &r)
+{
+	std::vector<lf_node *> hazards;
+	sample();
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	for (unsigned k = 0; k < nrecords; ++k)
+		for (auto &h : records[k].hazards)
+			if (lf_node *p = h.load(std::memory_order_acquire))
+				hazards.push_back(p);
+	std::sort(hazards.begin(), hazards.end());
+	auto kept = std::partition(r.retired.begin(), r.retired.end(),
+			[&] (const std::pair<lf_node *, u64> &n) {
+		return std::binary_search(hazards.begin(), hazards.end(),
+				n.first);
+	});
+	for (auto it = kept; it != r.retired.end(); ++it)
+		free(it->first);
+	r.retired.erase(kept, r.retired.end());
+}
+
+epoch_reclaim::guard::guard(epoch_reclaim &d) : r(d.local())
+{
+	r.epoch.store(d.global.load(std::memory_order_relaxed) << 1 | 1,
+			std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void
+epoch_reclaim::retire(lf_node *n)
+{
+	auto &r = local();
+	r.retired.emplace_back(n, global.load(std::memory_order_relaxed));
+	if (r.retired.size() % 64 == 0)
+		collect(r);
+}
+
+/* Moves the global epoch on if every thread in an operation has seen it, and
+ * frees the nodes retired two epochs ago or earlier, which nobody can reach.
+ */
+void
+epoch_reclaim::collect(reclaim_record &r)
+{
+	sample();
+	/* Pairs with the fence in guard(): either we see a thread's epoch or
+	 * it sees the node already unlinked.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	u64 e = global.load(std::memory_order_seq_cst);
+	bool advance = true;
+	for (unsigned k = 0; k < nrecords && advance; ++k) {
+		u64 x = records[k].epoch.load(std::memory_order_acquire);
+		advance = !(x & 1) || x >> 1 == e;
+	}
+	if (advance && global.compare_exchange_strong(e, e + 1))
+		++e;
+	auto kept = std::partition(r.retired.begin(), r.retired.end(),
+			[&] (const std::pair<lf_node *, u64> &n) {
+		return n.second + 2 > e;
+	});
+	for (auto it = kept; it != r.retired.end(); ++it)
+		free(it->first);
+	r.retired.erase(kept, r.retired.end());
+}
+
+template <typename Reclaim>
+treiber_stack<Reclaim>::~treiber_stack()
+{
+	for (lf_node *n = top, *next; n; n = next) {
+		next = n->next;
+		reclaim.free(n);
+	}
+}
+
+template <typename Reclaim>
+void
+treiber_stack<Reclaim>::push(u64 item)
+{
+	lf_node *n = reclaim.alloc(item);
+	lf_node *t = top.load(std::memory_order_relaxed);
+	do
+		n->next.store(t, std::memory_order_relaxed);
+	while (!top.compare_exchange_weak(t, n, std::memory_order_release,
+				std::memory_order_relaxed));
+}
+
+template <typename Reclaim>
+bool
+treiber_stack<Reclaim>::try_pop(u64 &item)
+{
+	typename Reclaim::guard g(reclaim);
+	for (;;) {
+		lf_node *t = g.protect(0, top);
+		if (!t)
+			return false;
+		lf_node *next = t->next.load(std::memory_order_relaxed);
+		if (top.compare_exchange_weak(t, next,
+					std::memory_order_acquire,
+					std::memory_order_relaxed)) {
+			item = t->value;
+			reclaim.retire(t);
+			return true;
+		}
+	}
+}
+
+template <typename Reclaim>
+u64
+treiber_stack<Reclaim>::pop()
+{
+	u64 item;
+	while (!try_pop(item))
+		asm("pause");
+	return item;
+}
+
+template <typename Reclaim>
+ms_queue<Reclaim>::ms_queue()
+{
+	lf_node *dummy = reclaim.alloc(0);
+	head = dummy;
+	tail = dummy;
+}
+
+template <typename Reclaim>
+ms_queue<Reclaim>::~ms_queue()
+{
+	for (lf_node *n = head, *next; n; n = next) {
+		next = n->next;
+		reclaim.free(n);
+	}
+}
+
+template <typename Reclaim>
+void
+ms_queue<Reclaim>::push(u64 item)
+{
+	lf_node *n = reclaim.alloc(item);
+	typename Reclaim::guard g(reclaim);
+	for (;;) {
+		lf_node *t = g.protect(0, tail);
+		lf_node *next = t->next.load(std::memory_order_acquire);
+		if (t != tail.load(std::memory_order_acquire))
+			continue;
+		if (next) {
+			/* Help a push that has linked its node in */
+			tail.compare_exchange_weak(t, next);
+			continue;
+		}
+		if (t->next.compare_exchange_weak(next, n,
+					std::memory_order_release,
+					std::memory_order_relaxed)) {
+			tail.compare_exchange_strong(t, n);
+			return;
+		}
+	}
+}
+
+template <typename Reclaim>
+bool
+ms_queue<Reclaim>::try_pop(u64 &item)
+{
+	typename Reclaim::guard g(reclaim);
+	for (;;) {
+		lf_node *h = g.protect(0, head);
+		lf_node *t = tail.load(std::memory_order_acquire);
+		lf_node *next = g.protect(1, h->next);
+		if (h != head.load(std::memory_order_acquire))
+			continue;
+		if (!next)
+			return false;
+		if (h == t) {
+			tail.compare_exchange_weak(t, next);
+			continue;
+		}
+		u64 value = next->value;
+		if (head.compare_exchange_weak(h, next,
+					std::memory_order_acq_rel,
+					std::memory_order_relaxed)) {
+			/* next is the new dummy node */
+			item = value;
+			reclaim.retire(h);
+			return true;
+		}
+	}
+}
+
+template <typename Reclaim>
+u64
+ms_queue<Reclaim>::pop()
+{
+	u64 item;
+	while (!try_pop(item))
+		asm("pause");
+	return item;
+}
+
+long
+adaptive_mutex::futex(int op, int val)
+{
+	futex_calls.fetch_add(1, std::memory_order_relaxed);
+	return ::futex(state, op, val);
+}
+
+void
+adaptive_mutex::lock()
+{
+	int c = 0;
+	if (state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+		return;
+
+	int estimate = spins.load(std::memory_order_relaxed);
+	int limit = std::min(estimate * 2 + 10, max_spins);
+	int n;
+	for (n = 0; n < limit; ++n) {
+		c = 0;
+		if (state.load(std::memory_order_relaxed) == 0
+				&& state.compare_exchange_weak(c, 1,
+					std::memory_order_acquire))
+			break;
+		asm("pause");
+	}
+	spins.store(estimate + (n - estimate) / 8, std::memory_order_relaxed);
+	if (n < limit)
+		return;
+
+	while (state.exchange(2, std::memory_order_acquire) != 0)
+		futex(FUTEX_WAIT_PRIVATE, 2);
+}
+
+void
+adaptive_mutex::unlock()
+{
+	if (state.exchange(0, std::memory_order_release) == 2)
+		futex(FUTEX_WAKE_PRIVATE, 1);
+}
+
+pshared_mutex::pshared_mutex(bool robust)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	if (robust)
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if (int err = pthread_mutex_init(&mutex, &attr))
+		DIE("pthread_mutex_init: " << std::strerror(err));
+	pthread_mutexattr_destroy(&attr);
+}
+
+void
+pshared_mutex::lock()
+{
+	/* Only robust mutexes can find their owner dead */
+	if (pthread_mutex_lock(&mutex) == EOWNERDEAD)
+		pthread_mutex_consistent(&mutex);
+}
+
+void
+shared_futex_mutex::lock()
+{
+	int c = 0;
+	if (state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+		return;
+	while (state.exchange(2, std::memory_order_acquire) != 0)
+		futex(state, FUTEX_WAIT, 2);
+}
+
+void
+shared_futex_mutex::unlock()
+{
+	if (state.exchange(0, std::memory_order_release) == 2)
+		futex(state, FUTEX_WAKE, 1);
+}
+
+u64
+parse_num(const char *s)
 {
 	char *end;
-	u64 iterations;
-	progname = argv[0];
-	if (argc != 2)
-		DIE("usage: " << progname << " <n_iterations>");
-	if ((iterations = strtoul(argv[1], &end, 10)) == ULONG_MAX)
-		DIE(argv[1] << " overflows uint64_t");
+	u64 n;
+	if ((n = strtoul(s, &end, 10)) == ULONG_MAX)
+		DIE(s << " overflows uint64_t");
 	if (*end != '\0')
-		DIE("could not parse `" << argv[1] << "'");
-	return iterations;
+		DIE("could not parse `" << s << "'");
+	return n;
+}
+
+/* Reads a single number from a sysfs file, -1 if it cannot */
+long
+read_sysfs(unsigned cpu, const char *file)
+{
+	std::ifstream f("/sys/devices/system/cpu/cpu" + std::to_string(cpu)
+			+ "/topology/" + file);
+	long n;
+	return f >> n ? n : -1;
+}
+
+/* CPU 0 with its SMT sibling, a core in its package and a core in another
+ * package, for the ones that exist.
+ */
+std::vector<cpu_pair>
+topology_pairs()
+{
+	std::vector<cpu_pair> found;
+	bool smt = false, socket = false, cross = false;
+	long package = read_sysfs(0, "physical_package_id");
+	long core = read_sysfs(0, "core_id");
+	unsigned nprocs = get_nprocs();
+	for (unsigned c = 1; c < nprocs; ++c) {
+		long p = read_sysfs(c, "physical_package_id");
+		long k = read_sysfs(c, "core_id");
+		if (p == package && k == core && !smt) {
+			found.push_back({0, c, "smt"});
+			smt = true;
+		} else if (p == package && k != core && !socket) {
+			found.push_back({0, c, "socket"});
+			socket = true;
+		} else if (p != package && !cross) {
+			found.push_back({0, c, "cross"});
+			cross = true;
+		}
+	}
+	return found;
+}
+
+/* Keep only the first n CPUs of the affinity mask */
+void
+restrict_cpus(unsigned n)
+{
+	cpu_set_t mask;
+	if (sched_getaffinity(0, sizeof(mask), &mask))
+		DIE("sched_getaffinity: " << std::strerror(errno));
+	if (n < 1 || n > (unsigned)CPU_COUNT(&mask))
+		DIE("-a must be between 1 and " << CPU_COUNT(&mask));
+	for (unsigned c = 0, kept = 0; c < CPU_SETSIZE; ++c) {
+		if (!CPU_ISSET(c, &mask))
+			continue;
+		if (kept++ >= n)
+			CPU_CLR(c, &mask);
+	}
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		DIE("sched_setaffinity: " << std::strerror(errno));
+}
+
+unsigned
+allowed_cpus()
+{
+	cpu_set_t mask;
+	if (sched_getaffinity(0, sizeof(mask), &mask))
+		DIE("sched_getaffinity: " << std::strerror(errno));
+	return CPU_COUNT(&mask);
+}
+
+u64
+parse_args(int argc, char *argv[])
+{
+	int opt;
+	progname = argv[0];
+	while ((opt = getopt(argc, argv, "t:i:o:msk:HlCp:a:O:P:f:")) != -1) {
+		switch (opt) {
+		case 't':
+			opts.threads = parse_num(optarg);
+			break;
+		case 'i':
+			opts.cs_work = parse_num(optarg);
+			break;
+		case 'o':
+			opts.noncs_work = parse_num(optarg);
+			break;
+		case 'm':
+			opts.memory = true;
+			break;
+		case 's':
+			opts.sweep = true;
+			break;
+		case 'k':
+			opts.shards = parse_num(optarg);
+			break;
+		case 'H':
+			opts.hashed = true;
+			break;
+		case 'l':
+			opts.layouts = true;
+			break;
+		case 'C':
+			opts.containers = true;
+			break;
+		case 'f':
+			opts.processes = parse_num(optarg);
+			if (opts.processes < 1)
+				DIE("need at least one process");
+			break;
+		case 'p': {
+			if (std::string(optarg) == "auto") {
+				pairs = topology_pairs();
+				if (pairs.empty())
+					DIE("no pairs of CPUs to ping-pong between");
+				break;
+			}
+			std::string arg(optarg);
+			auto comma = arg.find(',');
+			if (comma == std::string::npos)
+				DIE("-p takes auto or <cpu>,<cpu>");
+			cpu_pair p;
+			p.a = parse_num(arg.substr(0, comma).c_str());
+			p.b = parse_num(arg.substr(comma + 1).c_str());
+			p.label = "given";
+			pairs.push_back(p);
+			break;
+		}
+		case 'a':
+			restrict_cpus(parse_num(optarg));
+			break;
+		case 'O':
+			opts.oversubscribe = parse_num(optarg);
+			break;
+		case 'P': {
+			std::string arg(optarg);
+			auto comma = arg.find(',');
+			if (comma == std::string::npos)
+				DIE("-P takes <producers>,<consumers>");
+			producers = parse_num(arg.substr(0, comma).c_str());
+			consumers = parse_num(arg.substr(comma + 1).c_str());
+			if (producers < 1 || consumers < 1)
+				DIE("need at least one producer and consumer");
+			break;
+		}
+		default:
+			DIE("usage: " << progname << " " << usage);
+		}
+	}
+	if (optind != argc - 1)
+		DIE("usage: " << progname << " " << usage);
+	if ((opts.shards > 0) + opts.layouts + (opts.oversubscribe > 0)
+			+ opts.containers > 1)
+		DIE("-k, -l, -O and -C cannot be combined");
+	if (opts.oversubscribe > 0 && opts.threads > 0)
+		DIE("-t and -O cannot be combined");
+	if (opts.hashed && opts.shards == 0)
+		DIE("-H needs -k");
+	if (opts.shards > 0 && opts.threads == 0)
+		DIE("-k needs -t");
+	if (opts.layouts && opts.threads == 0)
+		DIE("-l needs -t");
+	if (producers > 0 && (opts.threads > 0 || opts.shards > 0
+			|| opts.layouts || opts.oversubscribe > 0
+			|| opts.containers))
+		DIE("-P cannot be combined with -t, -k, -l, -O or -C");
+	if (opts.processes > 0 && (opts.threads > 0 || opts.shards > 0
+			|| opts.layouts || opts.oversubscribe > 0
+			|| opts.containers || producers > 0 || !pairs.empty()))
+		DIE("-f cannot be combined with -t, -k, -l, -O, -C, -P or -p");
+	return parse_num(argv[optind]);
+}
+
+/* n units of work: NOPs, or with -m, writes to n of the lines of buf. Relaxed
+ * atomics so that racy cases (no lock) are still well-defined; they compile to
+ * plain loads and stores.
+ */
+inline void
+work(u64 n, std::atomic<unsigned char> *buf, u64 lines)
+{
+	if (!opts.memory) {
+		for (u64 k = 0; k < n; ++k)
+			asm("NOP");
+		return;
+	}
+	for (u64 k = 0; k < n; ++k) {
+		auto &b = buf[(k % lines) * cache_line];
+		b.store(b.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+	}
+}
+
+/* Runs opts.threads threads which together call op(t, i) its times, each
+ * call followed by opts.noncs_work units of work, and returns the time taken.
+ */
+template <typename Op>
+double
+run_threads(u64 its, Op op)
+{
+	const unsigned nthreads = opts.threads;
+	const u64 noncs_lines = std::max(opts.noncs_work, (u64)1);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> go(false);
+	double result;
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		u64 n = its / nthreads + (t < its % nthreads);
+		threads.emplace_back([&, t, n] {
+			std::vector<std::atomic<unsigned char>> own(
+					noncs_lines * cache_line);
+			ready++;
+			while (!go)
+				;
+			for (u64 i = 0; i < n; ++i) {
+				op(t, i);
+				work(opts.noncs_work, own.data(), noncs_lines);
+			}
+		});
+	}
+	while (ready != nthreads)
+		;
+	BENCH(result, {
+		go = true;
+		for (auto &t : threads)
+			t.join();
+	});
+	return result;
+}
+
+/* Runs opts.threads threads which together enter a critical section its
+ * times, alternating between push(i) and pop(), with opts.cs_work units of
+ * work inside and opts.noncs_work units of work outside of it. exec(t, f) must
+ * run f in mutual exclusion, on behalf of thread t.
+ */
+template <typename Exec, typename Push, typename Pop>
+void
+contended(const char *name, Exec exec, Push push, Pop pop, u64 its,
+		std::atomic<u64> *syscalls = nullptr)
+{
+	u64 syscalls_before = syscalls ? syscalls->load() : 0;
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	std::vector<std::atomic<unsigned char>> shared(cs_lines * cache_line);
+	double result;
+
+	std::cout << name << "," << opts.threads << "," << its << ",";
+	std::cout << opts.cs_work << "," << opts.noncs_work << ",";
+	result = run_threads(its, [&] (unsigned t, u64 i) {
+		exec(t, [&] {
+			work(opts.cs_work, shared.data(), cs_lines);
+			if (i % 2 == 0)
+				push(i);
+			else
+				pop();
+		});
+	});
+	std::cout << result << ",";
+	std::cout << ((double)its / result);
+	if (syscalls)
+		std::cout << "," << (double)(*syscalls - syscalls_before)
+			* 1000 / its;
+	std::cout << std::endl;
+}
+
+/* Every lock type under contention, at the current opts */
+void
+contended_cases(u64 iterations)
+{
+	std::deque<int> deque(iterations);
+	std::atomic<bool> atomic(0); /* true → is locked */
+	std::mutex mutex;
+	oneapi::tbb::spin_mutex spin_mutex;
+	oneapi::tbb::v1::mutex v1_mutex;
+	adaptive_mutex adaptive;
+
+	/* deque-nothing would corrupt the deque with more than one thread */
+	PAR("nothing-nothing", , ,
+			asm("NOP"), asm("NOP"),
+			iterations);
+	PAR("deque-mutex",
+			mutex.lock(), mutex.unlock(),
+			deque.push_front(i), deque.pop_back(),
+			iterations);
+	PAR("deque-atomic",
+			while (atomic.exchange(true, std::memory_order_acquire)),
+			atomic.store(false, std::memory_order_release),
+			deque.push_front(i), deque.pop_back(),
+			iterations);
+	PAR("deque-spin_mutex",
+			spin_mutex.lock(), spin_mutex.unlock(),
+			deque.push_front(i), deque.pop_back(),
+			iterations);
+	PAR("deque-v1_mutex",
+			v1_mutex.lock(), v1_mutex.unlock(),
+			deque.push_front(i), deque.pop_back(),
+			iterations);
+	PAR_SYS("deque-adaptive_mutex",
+			adaptive.lock(), adaptive.unlock(),
+			deque.push_front(i), deque.pop_back(),
+			iterations, adaptive.futex_calls);
+	{
+		flat_combiner fc(opts.threads);
+		PAR_VIA("deque-flat_combining",
+				fc.apply(t, f),
+				deque.push_front(i), deque.pop_back(),
+				iterations);
+	}
+	{
+		delegation_server server(opts.threads);
+		PAR_VIA("deque-delegation",
+				server.apply(t, f),
+				deque.push_front(i), deque.pop_back(),
+				iterations);
+	}
+}
+
+/* Every lock type protecting a Container, single-threaded, see -C */
+template <typename Container>
+void
+container_cases(const std::string &name, u64 iterations)
+{
+	Container c(iterations);
+	std::atomic<bool> atomic(0); /* true → is locked */
+	std::mutex mutex;
+	oneapi::tbb::spin_mutex spin_mutex;
+	oneapi::tbb::v1::mutex v1_mutex;
+	adaptive_mutex adaptive;
+
+	SEQ(name + "-nothing", , ,
+			c.push(i), keep(c.pop()),
+			iterations);
+	SEQ(name + "-mutex",
+			mutex.lock(), mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	SEQ(name + "-atomic",
+			while (atomic); atomic = true, atomic = false,
+			c.push(i), keep(c.pop()),
+			iterations);
+	SEQ(name + "-spin_mutex",
+			spin_mutex.lock(), spin_mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	SEQ(name + "-v1_mutex",
+			v1_mutex.lock(), v1_mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	SEQ(name + "-adaptive_mutex",
+			adaptive.lock(), adaptive.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+}
+
+/* Every lock type protecting a Container under contention */
+template <typename Container>
+void
+contended_container_cases(const std::string &name, u64 iterations)
+{
+	Container c(iterations);
+	std::atomic<bool> atomic(0); /* true → is locked */
+	std::mutex mutex;
+	oneapi::tbb::spin_mutex spin_mutex;
+	oneapi::tbb::v1::mutex v1_mutex;
+	adaptive_mutex adaptive;
+
+	PAR((name + "-mutex").c_str(),
+			mutex.lock(), mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	PAR((name + "-atomic").c_str(),
+			while (atomic.exchange(true, std::memory_order_acquire)),
+			atomic.store(false, std::memory_order_release),
+			c.push(i), keep(c.pop()),
+			iterations);
+	PAR((name + "-spin_mutex").c_str(),
+			spin_mutex.lock(), spin_mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	PAR((name + "-v1_mutex").c_str(),
+			v1_mutex.lock(), v1_mutex.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations);
+	PAR_SYS((name + "-adaptive_mutex").c_str(),
+			adaptive.lock(), adaptive.unlock(),
+			c.push(i), keep(c.pop()),
+			iterations, adaptive.futex_calls);
+}
+
+/* Every container, see -C */
+void
+all_container_cases(u64 iterations)
+{
+	if (opts.threads == 0) {
+		container_cases<ring_buffer>("ring", iterations);
+		container_cases<circular_buffer>("circular", iterations);
+		container_cases<pooled_list>("list", iterations);
+		container_cases<deque_container>("deque", iterations);
+		return;
+	}
+	contended_container_cases<ring_buffer>("ring", iterations);
+	contended_container_cases<circular_buffer>("circular", iterations);
+	contended_container_cases<pooled_list>("list", iterations);
+	contended_container_cases<deque_container>("deque", iterations);
+}
+
+/* Like contended(), but over nshards deques each protected by a Mutex. Pops
+ * from an empty shard steal from the next non-empty one.
+ */
+template <typename Mutex>
+void
+striped(const char *name, unsigned nshards, u64 its)
+{
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	std::vector<shard<Mutex>> shards(nshards);
+	std::atomic<u64> steals(0);
+	double result;
+
+	for (auto &s : shards) {
+		s.deque.resize(its / nshards);
+		s.data = std::vector<std::atomic<unsigned char>>(
+				cs_lines * cache_line);
+	}
+	auto select = [&] (unsigned t, u64 i) -> unsigned {
+		if (!opts.hashed)
+			return t % nshards;
+		u64 h = ((u64)t << 40 ^ i) * 0x9e3779b97f4a7c15;
+		return (h >> 32) % nshards;
+	};
+
+	std::cout << name << "," << opts.threads << "," << its << ",";
+	std::cout << opts.cs_work << "," << opts.noncs_work << ",";
+	result = run_threads(its, [&] (unsigned t, u64 i) {
+		unsigned first = select(t, i);
+		if (i % 2 == 0) {
+			auto &s = shards[first];
+			s.lock.lock();
+			work(opts.cs_work, s.data.data(), cs_lines);
+			s.deque.push_front(i);
+			s.lock.unlock();
+			return;
+		}
+		for (unsigned j = 0; j < nshards; ++j) {
+			auto &s = shards[(first + j) % nshards];
+			s.lock.lock();
+			bool found = !s.deque.empty();
+			if (found) {
+				work(opts.cs_work, s.data.data(), cs_lines);
+				s.deque.pop_back();
+			}
+			s.lock.unlock();
+			if (found) {
+				if (j > 0)
+					steals.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+		}
+	});
+	std::cout << result << ",";
+	std::cout << ((double)its / result) << ",";
+	std::cout << nshards << "," << (opts.hashed ? "hashed" : "affine");
+	std::cout << "," << (double)steals * 1000 / its << std::endl;
+}
+
+/* Every lock type protecting a striped deque, for 1, 2, 4, ... shards */
+void
+striped_cases(u64 iterations)
+{
+	for (unsigned k = 1; k <= opts.shards; k *= 2) {
+		striped<std::mutex>("striped-mutex", k, iterations);
+		striped<atomic_lock>("striped-atomic", k, iterations);
+		striped<oneapi::tbb::spin_mutex>("striped-spin_mutex", k,
+				iterations);
+		striped<oneapi::tbb::v1::mutex>("striped-v1_mutex", k,
+				iterations);
+		striped<adaptive_mutex>("striped-adaptive_mutex", k,
+				iterations);
+	}
+}
+
+/* Like contended(), but with Mutexes protecting counters, placed in memory
+ * according to l.
+ */
+template <typename Mutex>
+void
+placed(const char *name, layout l, u64 its)
+{
+	constexpr size_t page = 4096;
+	const unsigned nlocks = l == packed || l == private_ ? opts.threads : 1;
+	const size_t lock_size = (sizeof(Mutex) + alignof(u64) - 1)
+		/ alignof(u64) * alignof(u64);
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	std::vector<std::atomic<unsigned char>> shared(cs_lines * cache_line);
+	std::vector<size_t> lock_at(nlocks), data_at(nlocks);
+	size_t size;
+	double result;
+
+	static_assert(sizeof(Mutex) + sizeof(u64) <= cache_line,
+			"lock does not fit in a line next to its data");
+	switch (l) {
+	case colocated:
+		lock_at[0] = 0;
+		data_at[0] = lock_size;
+		break;
+	case padded:
+		lock_at[0] = 0;
+		data_at[0] = cache_line;
+		break;
+	case separate:
+		lock_at[0] = 0;
+		data_at[0] = page;
+		break;
+	case packed: {
+		size_t data_start = (nlocks * lock_size + cache_line - 1)
+			/ cache_line * cache_line;
+		for (unsigned k = 0; k < nlocks; ++k) {
+			lock_at[k] = k * lock_size;
+			data_at[k] = data_start + k * cache_line;
+		}
+		break;
+	}
+	case private_:
+		for (unsigned k = 0; k < nlocks; ++k) {
+			lock_at[k] = 2 * k * cache_line;
+			data_at[k] = (2 * k + 1) * cache_line;
+		}
+		break;
+	}
+	size = (data_at.back() + cache_line + page - 1) / page * page;
+
+	unsigned char *mem = static_cast<unsigned char *>(
+			std::aligned_alloc(page, size));
+	std::vector<Mutex *> locks(nlocks);
+	std::vector<u64 *> data(nlocks);
+	for (unsigned k = 0; k < nlocks; ++k) {
+		locks[k] = new (mem + lock_at[k]) Mutex();
+		data[k] = new (mem + data_at[k]) u64(0);
+	}
+
+	std::cout << name << "," << opts.threads << "," << its << ",";
+	std::cout << opts.cs_work << "," << opts.noncs_work << ",";
+	result = run_threads(its, [&] (unsigned t, u64 i) {
+		unsigned k = t % nlocks;
+		locks[k]->lock();
+		work(opts.cs_work, shared.data(), cs_lines);
+		++*data[k];
+		locks[k]->unlock();
+	});
+	std::cout << result << ",";
+	std::cout << ((double)its / result) << ",";
+	std::cout << layout_names[l] << std::endl;
+
+	for (auto m : locks)
+		m->~Mutex();
+	std::free(mem);
+}
+
+/* Every lock type in every layout */
+void
+layout_cases(u64 iterations)
+{
+	for (layout l : {colocated, padded, separate, packed, private_}) {
+		placed<std::mutex>("placed-mutex", l, iterations);
+		placed<atomic_lock>("placed-atomic", l, iterations);
+		placed<oneapi::tbb::spin_mutex>("placed-spin_mutex", l,
+				iterations);
+		placed<oneapi::tbb::v1::mutex>("placed-v1_mutex", l,
+				iterations);
+		placed<adaptive_mutex>("placed-adaptive_mutex", l,
+				iterations);
+	}
+}
+
+/* p in [0, 1] of sorted v */
+double
+percentile(const std::vector<double> &v, double p)
+{
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+void
+pin(unsigned cpu)
+{
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask))
+		DIE("sched_setaffinity: " << std::strerror(errno));
+}
+
+/* Passes a Mutex back and forth between two threads pinned to the CPUs of
+ * pair, samples times. Each round, the thread holding the lock waits for the
+ * other to announce that it is about to lock, does opts.cs_work units of work
+ * and timestamps its release; the other then timestamps its acquisition.
+ */
+template <typename Mutex>
+void
+pingpong(const char *name, const cpu_pair &pair, u64 samples)
+{
+	typedef std::chrono::steady_clock clk;
+	Mutex m;
+	std::atomic<u64> waiting(0); /* round the waiter has reached */
+	std::atomic<u64> acquired(0); /* rounds in which it got the lock */
+	std::atomic<clk::rep> released(0);
+	std::vector<double> latencies(samples);
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	std::vector<std::atomic<unsigned char>> shared(cs_lines * cache_line);
+
+	/* Spin, then yield in case the other player shares our core */
+	auto await = [] (std::atomic<u64> &a, u64 value) {
+		for (unsigned spins = 0;
+				a.load(std::memory_order_acquire) != value;
+				++spins) {
+			if (spins < 1000)
+				asm("pause");
+			else
+				sched_yield();
+		}
+	};
+
+	auto player = [&] (unsigned me, unsigned cpu) {
+		pin(cpu);
+		for (u64 k = 0; k < samples; ++k) {
+			if (k % 2 == me) {
+				await(waiting, k + 1);
+				work(opts.cs_work, shared.data(), cs_lines);
+				released.store(clk::now().time_since_epoch()
+						.count(), std::memory_order_relaxed);
+				m.unlock();
+				/* Or we could take it right back next round */
+				await(acquired, k + 1);
+			} else {
+				waiting.store(k + 1, std::memory_order_release);
+				m.lock();
+				auto now = clk::now().time_since_epoch().count();
+				clk::duration d(now - released.load(
+						std::memory_order_relaxed));
+				latencies[k] = std::chrono::duration<double>(d)
+					.count();
+				acquired.store(k + 1, std::memory_order_release);
+			}
+		}
+		/* Whoever got the lock last still holds it */
+		if (samples % 2 == me)
+			m.unlock();
+	};
+
+	m.lock(); /* the first round's holder is player 0 */
+	std::thread other(player, 1, pair.b);
+	player(0, pair.a);
+	other.join();
+
+	std::sort(latencies.begin(), latencies.end());
+	std::cout << name << "," << pair.a << "," << pair.b << ",";
+	std::cout << pair.label << "," << samples << ",";
+	std::cout << latencies.front() << ",";
+	std::cout << percentile(latencies, 0.5) << ",";
+	std::cout << percentile(latencies, 0.9) << ",";
+	std::cout << percentile(latencies, 0.99) << ",";
+	std::cout << latencies.back() << std::endl;
+}
+
+/* Every lock type between every pair */
+void
+pingpong_cases(u64 samples)
+{
+	for (auto &pair : pairs) {
+		pingpong<std::mutex>("pingpong-mutex", pair, samples);
+		pingpong<atomic_lock>("pingpong-atomic", pair, samples);
+		pingpong<oneapi::tbb::spin_mutex>("pingpong-spin_mutex", pair,
+				samples);
+		pingpong<oneapi::tbb::v1::mutex>("pingpong-v1_mutex", pair,
+				samples);
+		pingpong<adaptive_mutex>("pingpong-adaptive_mutex", pair,
+				samples);
+	}
+}
+
+/* Like contended(), but timing every acquisition of a Mutex, which protects
+ * a deque. Meant to be ran with more threads than CPUs.
+ */
+template <typename Mutex>
+void
+oversubscribed(const char *name, unsigned cpus, u64 its)
+{
+	typedef std::chrono::steady_clock clk;
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	std::vector<std::atomic<unsigned char>> shared(cs_lines * cache_line);
+	std::vector<std::vector<double>> waits(opts.threads);
+	std::deque<int> deque(its);
+	Mutex m;
+	double result;
+
+	for (auto &w : waits)
+		w.reserve(its / opts.threads + 1);
+	std::cout << name << "," << opts.threads << "," << its << ",";
+	std::cout << opts.cs_work << "," << opts.noncs_work << ",";
+	result = run_threads(its, [&] (unsigned t, u64 i) {
+		auto start = clk::now();
+		m.lock();
+		auto locked = clk::now();
+		work(opts.cs_work, shared.data(), cs_lines);
+		if (i % 2 == 0)
+			deque.push_front(i);
+		else
+			deque.pop_back();
+		m.unlock();
+		std::chrono::duration<double> d = locked - start;
+		waits[t].push_back(d.count());
+	});
+
+	std::vector<double> all;
+	all.reserve(its);
+	for (auto &w : waits)
+		all.insert(all.end(), w.begin(), w.end());
+	std::sort(all.begin(), all.end());
+	std::cout << result << ",";
+	std::cout << ((double)its / result) << ",";
+	std::cout << cpus << ",";
+	std::cout << percentile(all, 0.5) << ",";
+	std::cout << percentile(all, 0.99) << ",";
+	std::cout << percentile(all, 0.999) << ",";
+	std::cout << all.back() << std::endl;
+}
+
+/* Every lock type with 1, 2, 4, ... opts.oversubscribe threads per CPU */
+void
+oversubscribed_cases(u64 iterations)
+{
+	unsigned cpus = allowed_cpus();
+	for (unsigned f = 1; f <= opts.oversubscribe; f *= 2) {
+		opts.threads = f * cpus;
+		oversubscribed<std::mutex>("oversubscribed-mutex", cpus,
+				iterations);
+		oversubscribed<atomic_lock>("oversubscribed-atomic", cpus,
+				iterations);
+		oversubscribed<oneapi::tbb::spin_mutex>(
+				"oversubscribed-spin_mutex", cpus, iterations);
+		oversubscribed<oneapi::tbb::v1::mutex>(
+				"oversubscribed-v1_mutex", cpus, iterations);
+		oversubscribed<adaptive_mutex>(
+				"oversubscribed-adaptive_mutex", cpus,
+				iterations);
+	}
+}
+
+/* What -f's processes share: a Mutex protecting a ring buffer, followed by
+ * the buffer for critical section work.
+ */
+template <typename Mutex>
+struct shm_region {
+	static constexpr u64 capacity = 4096;
+
+	Mutex lock;
+	alignas(cache_line) std::atomic<unsigned> ready;
+	std::atomic<bool> go;
+	alignas(cache_line) u64 head, tail;
+	int ring[capacity];
+};
+
+/* Like contended(), but between opts.processes processes sharing a Mutex
+ * and the ring buffer it protects, which starts half full. As every process
+ * alternates between pushing and popping, it never fills up or runs dry.
+ */
+template <typename Mutex>
+void
+shared_memory(const char *name, u64 its)
+{
+	typedef shm_region<Mutex> region;
+	const unsigned nprocs = opts.processes;
+	const u64 cs_lines = std::max(opts.cs_work, (u64)1);
+	const u64 noncs_lines = std::max(opts.noncs_work, (u64)1);
+	const size_t size = sizeof(region) + cs_lines * cache_line;
+	std::string path = "/mutexes-" + std::to_string(getpid());
+	std::vector<pid_t> children;
+	double result;
+
+	int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0)
+		DIE("shm_open: " << std::strerror(errno));
+	if (ftruncate(fd, size))
+		DIE("ftruncate: " << std::strerror(errno));
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+	if (mem == MAP_FAILED)
+		DIE("mmap: " << std::strerror(errno));
+	/* The children inherit the mapping, so the name is not needed */
+	shm_unlink(path.c_str());
+	close(fd);
+
+	region *r = new (mem) region();
+	r->head = region::capacity / 2;
+	r->tail = 0;
+	auto *shared = reinterpret_cast<std::atomic<unsigned char> *>(r + 1);
+	for (u64 k = 0; k < cs_lines * cache_line; ++k)
+		new (&shared[k]) std::atomic<unsigned char>(0);
+
+	std::cout << std::flush;
+	for (unsigned p = 0; p < nprocs; ++p) {
+		u64 n = its / nprocs + (p < its % nprocs);
+		pid_t pid = fork();
+		if (pid < 0)
+			DIE("fork: " << std::strerror(errno));
+		if (pid > 0) {
+			children.push_back(pid);
+			continue;
+		}
+		std::vector<std::atomic<unsigned char>> own(
+				noncs_lines * cache_line);
+		r->ready++;
+		while (!r->go)
+			;
+		for (u64 i = 0; i < n; ++i) {
+			r->lock.lock();
+			work(opts.cs_work, shared, cs_lines);
+			if (i % 2 == 0)
+				r->ring[r->head++ % region::capacity] = i;
+			else
+				keep(r->ring[r->tail++ % region::capacity]);
+			r->lock.unlock();
+			work(opts.noncs_work, own.data(), noncs_lines);
+		}
+		_exit(EXIT_SUCCESS);
+	}
+	while (r->ready != nprocs)
+		;
+	BENCH(result, {
+		r->go = true;
+		for (pid_t pid : children) {
+			int status;
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+					|| WEXITSTATUS(status) != EXIT_SUCCESS)
+				DIE("process " << pid << " failed");
+		}
+	});
+
+	std::cout << name << "," << nprocs << "," << its << ",";
+	std::cout << opts.cs_work << "," << opts.noncs_work << ",";
+	std::cout << result << ",";
+	std::cout << ((double)its / result) << std::endl;
+
+	r->~region();
+	munmap(mem, size);
+}
+
+/* Every lock type that works between processes, see -f */
+void
+shared_memory_cases(u64 iterations)
+{
+	shared_memory<pshared_mutex>("shm-pthread_mutex", iterations);
+	shared_memory<robust_mutex>("shm-robust_mutex", iterations);
+	shared_memory<shared_futex_mutex>("shm-futex", iterations);
+	shared_memory<atomic_lock>("shm-atomic", iterations);
+}
+
+/* The extra column of -P rows for structures that count their nodes */
+template <typename Queue>
+void
+print_memory(const Queue &)
+{
+}
+
+template <typename Reclaim>
+void
+print_memory(const treiber_stack<Reclaim> &q)
+{
+	std::cout << "," << q.peak_nodes() * sizeof(lf_node);
+}
+
+template <typename Reclaim>
+void
+print_memory(const ms_queue<Reclaim> &q)
+{
+	std::cout << "," << q.peak_nodes() * sizeof(lf_node);
+}
+
+/* A count only written by one thread */
+struct alignas(cache_line) padded_count {
+	std::atomic<u64> n {0};
+};
+
+u64
+total(const std::vector<padded_count> &counts)
+{
+	u64 sum = 0;
+	for (auto &c : counts)
+		sum += c.n.load(std::memory_order_acquire);
+	return sum;
+}
+
+/* Runs producers and consumers concurrently over a Queue, see -P. Items are
+ * push timestamps; once they have all been popped, each consumer is stopped
+ * by a final item of 0 (only then, so that consumers of a stack do not stop
+ * early).
+ */
+template <typename Queue>
+void
+pipeline(const char *name, u64 items)
+{
+	typedef std::chrono::steady_clock clk;
+	Queue queue;
+	std::vector<std::vector<double>> latencies(consumers);
+	std::vector<padded_count> popped(consumers);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> go(false);
+	const u64 noncs_lines = std::max(opts.noncs_work, (u64)1);
+	double result;
+
+	for (unsigned c = 0; c < consumers; ++c) {
+		latencies[c].reserve(items / consumers + 1);
+		threads.emplace_back([&, c] {
+			ready++;
+			while (!go)
+				;
+			for (;;) {
+				u64 item = queue.pop();
+				if (item == 0)
+					break;
+				auto now = clk::now().time_since_epoch().count();
+				clk::duration d(now - (clk::rep)item);
+				latencies[c].push_back(
+					std::chrono::duration<double>(d).count());
+				popped[c].n.store(latencies[c].size(),
+						std::memory_order_release);
+			}
+		});
+	}
+	for (unsigned p = 0; p < producers; ++p) {
+		u64 n = items / producers + (p < items % producers);
+		threads.emplace_back([&, n] {
+			std::vector<std::atomic<unsigned char>> own(
+					noncs_lines * cache_line);
+			ready++;
+			while (!go)
+				;
+			for (u64 i = 0; i < n; ++i) {
+				work(opts.noncs_work, own.data(), noncs_lines);
+				queue.push(clk::now().time_since_epoch().count());
+			}
+		});
+	}
+	while (ready != producers + consumers)
+		;
+	BENCH(result, {
+		go = true;
+		for (unsigned p = 0; p < producers; ++p)
+			threads[consumers + p].join();
+		while (total(popped) < items)
+			sched_yield();
+		for (unsigned c = 0; c < consumers; ++c)
+			queue.push(0);
+		for (unsigned c = 0; c < consumers; ++c)
+			threads[c].join();
+	});
+
+	std::vector<double> all;
+	all.reserve(items);
+	for (auto &l : latencies)
+		all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+	std::cout << name << "," << producers << "," << consumers << ",";
+	std::cout << items << "," << result << ",";
+	std::cout << ((double)items / result) << ",";
+	std::cout << percentile(all, 0.5) << ",";
+	std::cout << percentile(all, 0.99) << ",";
+	std::cout << all.back();
+	print_memory(queue);
+	std::cout << std::endl;
+}
+
+/* Every way of waiting for items, and the lock-free structures */
+void
+pipeline_cases(u64 items)
+{
+	pipeline<condvar_queue>("condvar", items);
+	pipeline<bounded_queue>("bounded_queue", items);
+	pipeline<eventcount_queue>("eventcount", items);
+	pipeline<busy_poll_queue>("busy_poll", items);
+	pipeline<treiber_stack<hazard_reclaim>>("treiber-hazard", items);
+	pipeline<treiber_stack<epoch_reclaim>>("treiber-epoch", items);
+	pipeline<treiber_stack<leak_reclaim>>("treiber-leak", items);
+	pipeline<ms_queue<hazard_reclaim>>("msqueue-hazard", items);
+	pipeline<ms_queue<epoch_reclaim>>("msqueue-epoch", items);
+	pipeline<ms_queue<leak_reclaim>>("msqueue-leak", items);
+}
+
+/* 0, 1, 4, 16, ... */
+u64
+next_step(u64 n)
+{
+	return n == 0 ? 1 : n * 4;
 }
 
 int
 main(int argc, char *argv[])
 {
 	u64 iterations = parse_args(argc, argv);
+	if (producers > 0) {
+		if (iterations < 1)
+			DIE("need at least one item");
+		pipeline_cases(iterations);
+		return 0;
+	}
+	if (!pairs.empty()) {
+		if (iterations < 1)
+			DIE("need at least one sample");
+		pingpong_cases(iterations);
+		return 0;
+	}
+	if (opts.threads > 0 || opts.oversubscribe > 0 || opts.processes > 0) {
+		if (iterations < 1)
+			DIE("need at least one iteration");
+		auto cases = opts.processes > 0 ? shared_memory_cases
+			: opts.shards > 0 ? striped_cases
+			: opts.layouts ? layout_cases
+			: opts.containers ? all_container_cases
+			: opts.oversubscribe > 0 ? oversubscribed_cases
+			: contended_cases;
+		if (!opts.sweep) {
+			cases(iterations);
+			return 0;
+		}
+		u64 max_cs = opts.cs_work, max_noncs = opts.noncs_work;
+		for (u64 cs = 0; cs <= max_cs; cs = next_step(cs)) {
+			for (u64 noncs = 0; noncs <= max_noncs;
+					noncs = next_step(noncs)) {
+				opts.cs_work = cs;
+				opts.noncs_work = noncs;
+				cases(iterations);
+			}
+		}
+		return 0;
+	}
+	if (opts.containers) {
+		all_container_cases(iterations);
+		return 0;
+	}
+
 	std::deque<int> deque(iterations);
 	std::atomic<bool> atomic(0); /* true → is locked */
 	std::mutex mutex;
 	oneapi::tbb::spin_mutex spin_mutex;
 	oneapi::tbb::v1::mutex v1_mutex;
 	oneapi::tbb::queuing_mutex queuing_mutex;
+	adaptive_mutex adaptive;
 
 	SEQ("nothing-nothing", , ,
 			asm("NOP"), asm("NOP"),
@@ -91,6 +2271,10 @@ main(int argc, char *argv[])
 			v1_mutex.lock(), v1_mutex.unlock(),
 			deque.push_front(i), deque.pop_back(),
 			iterations);
+	SEQ("deque-adaptive_mutex",
+			adaptive.lock(), adaptive.unlock(),
+			deque.push_front(i), deque.pop_back(),
+			iterations);
 	/* Currently excluded. Only locking interface is ::scoped_lock, which
 	 * seems to increase performance for other mutex types. Possibly being
 	 * optimized behind the scenes.
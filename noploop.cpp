@@ -1,12 +1,101 @@
+/* TBB NOP loop which measures scheduling throughput
+ *
+ * usage: ./noploop [-c count] [-N] [-F nodes] [-T core_type] [-P] [-D]
+ * 		[-S stages] [-W work] [-L tokens]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<method> <threads> <iterations>
+ *
+ * and writes results to standard output with the following format:
+ *
+ * 	<method> <threads> <iterations> <time> <iterations/sec>
+ *
+ * Where method is one of:
+ *
+ * 	0	serial NOP loop
+ * 	1	parallel_for of NOPs
+ * 	2	task_group running one NOP task per iteration
+ * 	3	parallel_for of nanosleep(0)
+ * 	4	parallel_for reading a buffer of iterations elements
+ * 	5	parallel_reduce summing the indices of a NOP loop
+ * 	6	parallel_scan computing the prefix sums of a buffer, in place
+ * 	7	parallel_sort of a buffer of pseudo-random numbers, which are
+ * 		generated again (untimed) before every run
+ * 	8	parallel_for_each incrementing every element of a buffer
+ * 	9	parallel_pipeline of iterations items through stages stages
+ * 		(default 3), each doing work NOPs (default 100) per item
+ *
+ * For methods 4 and up, iterations is the number of elements, so the last
+ * column is elements/sec. Each test is ran count times (default 1).
+ *
+ * Method 9 is ran for every filter mode of the stages after the first one
+ * (which is always serial_in_order): in_order, out_of_order and parallel, and
+ * for 1, 2, 4, ... up to tokens (default 4 * threads) live tokens. Its results
+ * have four extra columns after iterations/sec:
+ *
+ * 	<mode> <tokens> <p50> <p99>
+ *
+ * Where p50 and p99 describe the time from an item entering the first stage
+ * until it left the last one, in seconds. Method 9 cannot be combined with
+ * -N.
+ *
+ * With -N, each test is ran once per NUMA configuration and the name of the
+ * configuration is appended to every result:
+ *
+ * 	local	one arena on the first node, data on the first node
+ * 	remote	one arena on the last node, data on the first node
+ * 	spread	one arena per node, threads and iterations split between them,
+ * 		each with data on its own node
+ * 	cross	one arena pinned round-robin across all nodes, data on the first
+ * 		node
+ *
+ * -F nodes pretends that the machine has the given number of NUMA nodes by
+ * splitting the CPUs into that many contiguous groups, so NUMA mode can be
+ * exercised on a single-node box.
+ *
+ * With -T, arenas are constrained to the hardware threads of the given core
+ * type and the core type is appended to every result. Core types are numbered
+ * from the least to the most performant, as with tbb::info::core_types(); on
+ * machines where TBB cannot tell them apart, they are told apart by
+ * /sys/devices/system/cpu/cpuN/cpu_capacity or the cpu_atom/cpu_core PMU
+ * devices. -T cannot be combined with -N.
+ *
+ * With -P, arenas are kept across input lines, one per thread count, instead
+ * of being created for every line. Each one is warmed up when it is created:
+ * it is initialized and then runs tasks until every thread has entered it (or
+ * 100ms have passed, if TBB cannot give it that many workers). The time this
+ * took is the arena's startup latency and is appended to every result, after
+ * the core type. -P cannot be combined with -N.
+ *
+ * Methods are types, and the timed call into one is compiled for each of
+ * them. With -D, every test is also ran by calling the method through a
+ * function pointer, as noploop used to, and results have an extra column
+ * (after all the others) saying how the method was called: pointer or
+ * template. -D cannot be combined with -N.
+ */
+
+#define TBB_PREVIEW_TASK_ARENA_CONSTRAINTS_EXTENSION 1
+
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <climits>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <oneapi/tbb.h>
 #include <sched.h>
+#include <set>
+#include <string>
 #include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 #define NOP asm("NOP")
 
@@ -14,22 +103,166 @@ typedef std::uint64_t u64;
 
 class pinning_observer : public oneapi::tbb::task_scheduler_observer {
 	const unsigned nprocs;
+	const std::vector<unsigned> cpus;
 	std::atomic<unsigned> count;
+	/* Threads that entered, as a thread entering again counts once */
+	oneapi::tbb::spin_mutex seen_mutex;
+	std::set<std::thread::id> seen;
+	std::atomic<unsigned> nthreads;
 public:
 	pinning_observer(oneapi::tbb::task_arena &a);
+	/* Pin round-robin over the given CPUs instead of all of them */
+	pinning_observer(oneapi::tbb::task_arena &a,
+			const std::vector<unsigned> &cpus);
 	void on_scheduler_entry(bool _w);
+	/* Number of distinct threads that entered the arena */
+	unsigned threads() const;
+};
+
+/* An arena with its observer, kept across input lines with -P */
+struct pinned_arena {
+	oneapi::tbb::task_arena arena;
+	pinning_observer observer;
+	double startup; /* seconds to initialize and see every thread */
+
+	pinned_arena(const oneapi::tbb::task_arena::constraints &c,
+			const std::vector<unsigned> &cpus);
+	void warm_up(int threads);
+};
+
+struct numa_node {
+	int id; /* TBB NUMA node id, -1 when faked */
+	std::vector<unsigned> cpus;
 };
 
 void serial(u64);
 void parallel_for(u64);
 void task_group(u64);
+void parallel_for_nanosleep(u64);
+void stream(const u64 *, u64);
+void parallel_for_stream(u64);
+void parallel_reduce(u64);
+void scan(u64 *, u64);
+void parallel_scan(u64);
+void sort(u64 *, u64);
+void parallel_sort(u64);
+void for_each(u64 *, u64);
+void parallel_for_each(u64);
+void parallel_pipeline(u64);
+
+/* The methods as types. run(d, n) does what the function does, on the n
+ * elements at d for the methods that use a buffer; prepare(d, n) sets the
+ * buffer up before every run.
+ */
+struct method_tag {
+	static constexpr bool uses_data = false;
+	static void prepare(u64 *, u64) {}
+};
+
+struct serial_method : method_tag {
+	static void run(u64 *, u64 n) {serial(n);}
+};
+
+struct parallel_for_method : method_tag {
+	static void run(u64 *, u64 n) {parallel_for(n);}
+};
+
+struct task_group_method : method_tag {
+	static void run(u64 *, u64 n) {task_group(n);}
+};
+
+struct nanosleep_method : method_tag {
+	static void run(u64 *, u64 n) {parallel_for_nanosleep(n);}
+};
+
+struct stream_method : method_tag {
+	static constexpr bool uses_data = true;
+	static void run(u64 *d, u64 n) {stream(d, n);}
+};
+
+struct reduce_method : method_tag {
+	static void run(u64 *, u64 n) {parallel_reduce(n);}
+};
+
+struct scan_method : method_tag {
+	static constexpr bool uses_data = true;
+	static void run(u64 *d, u64 n) {scan(d, n);}
+};
+
+struct sort_method : method_tag {
+	static constexpr bool uses_data = true;
+	static void prepare(u64 *d, u64 n);
+	static void run(u64 *d, u64 n) {sort(d, n);}
+};
+
+struct for_each_method : method_tag {
+	static constexpr bool uses_data = true;
+	static void run(u64 *d, u64 n) {for_each(d, n);}
+};
+
+struct pipeline_method : method_tag {
+	static void prepare(u64 *, u64 n);
+	static void run(u64 *, u64 n) {parallel_pipeline(n);}
+};
+
+/* The same methods as function pointers, for -D */
+void (*const method_functions[])(u64) = {
+	serial,
+	parallel_for,
+	task_group,
+	parallel_for_nanosleep,
+	parallel_for_stream,
+	parallel_reduce,
+	parallel_scan,
+	parallel_sort,
+	parallel_for_each,
+	parallel_pipeline,
+};
+
+template <typename F> bool dispatch(int, F);
+std::vector<unsigned> parse_cpulist(const std::string &);
+std::vector<numa_node> numa_topology(unsigned fake);
+std::vector<std::vector<unsigned>> core_type_cpus();
+template <typename Method>
+void numa_run(const std::vector<numa_node> &, int, int, u64);
 
 constexpr char tab = '\t';
 
+/* Buffer used by methods 4 and up, first touched by place_data */
+u64 *data = nullptr;
+
+/* Configuration of parallel_pipeline, see top of file */
+unsigned pipeline_stages = 3;
+u64 pipeline_work = 100;
+unsigned pipeline_mode = 2; /* in filter_modes */
+size_t pipeline_tokens = 1;
+/* Seconds each item spent in the last parallel_pipeline */
+std::vector<double> pipeline_latencies;
+
+const oneapi::tbb::filter_mode filter_modes[] = {
+	oneapi::tbb::filter_mode::serial_in_order,
+	oneapi::tbb::filter_mode::serial_out_of_order,
+	oneapi::tbb::filter_mode::parallel,
+};
+
+const char *filter_mode_names[] = {"in_order", "out_of_order", "parallel"};
+
 pinning_observer::pinning_observer(oneapi::tbb::task_arena &a):
 		oneapi::tbb::task_scheduler_observer(a),
 		nprocs(get_nprocs()),
-		count(0)
+		count(0),
+		nthreads(0)
+{
+	observe(true);
+}
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &a,
+		const std::vector<unsigned> &cpus):
+		oneapi::tbb::task_scheduler_observer(a),
+		nprocs(get_nprocs()),
+		cpus(cpus),
+		count(0),
+		nthreads(0)
 {
 	observe(true);
 }
@@ -39,9 +272,52 @@ pinning_observer::on_scheduler_entry(bool _w)
 {
 	cpu_set_t *mask = CPU_ALLOC(nprocs);
 	auto size = CPU_ALLOC_SIZE(nprocs);
+	unsigned i = count++;
 	CPU_ZERO_S(size, mask);
-	CPU_SET_S(count++ % nprocs, size, mask);
+	if (cpus.empty())
+		CPU_SET_S(i % nprocs, size, mask);
+	else
+		CPU_SET_S(cpus[i % cpus.size()], size, mask);
 	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+	oneapi::tbb::spin_mutex::scoped_lock lock(seen_mutex);
+	if (seen.insert(std::this_thread::get_id()).second)
+		nthreads++;
+}
+
+unsigned
+pinning_observer::threads() const
+{
+	return nthreads;
+}
+
+pinned_arena::pinned_arena(const oneapi::tbb::task_arena::constraints &c,
+		const std::vector<unsigned> &cpus):
+		arena(c),
+		observer(arena, cpus),
+		startup(0)
+{
+}
+
+/* Spins in every iteration so that idle workers have to join in, until
+ * threads have entered the arena or the deadline passes.
+ */
+void
+pinned_arena::warm_up(int threads)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto start = clock::now();
+	auto deadline = start + std::chrono::milliseconds(100);
+	arena.initialize();
+	arena.execute([&] {
+		oneapi::tbb::parallel_for(0, threads, [&] (int _) {
+			while (observer.threads() < (unsigned)threads
+					&& clock::now() < deadline)
+				asm("pause");
+		}, oneapi::tbb::simple_partitioner());
+	});
+	std::chrono::duration<double> diff = clock::now() - start;
+	startup = diff.count();
 }
 
 void
@@ -83,18 +359,484 @@ parallel_for_nanosleep(u64 n)
 	});
 }
 
+void
+stream(const u64 *d, u64 n)
+{
+	oneapi::tbb::parallel_for((u64)0, n, [d] (const u64 &i) {
+		asm volatile("" : : "r"(d[i]));
+	});
+}
+
+void
+parallel_for_stream(u64 n)
+{
+	stream(data, n);
+}
+
+void
+parallel_reduce(u64 n)
+{
+	typedef oneapi::tbb::blocked_range<u64> range;
+	u64 sum = oneapi::tbb::parallel_reduce(range(0, n), (u64)0,
+			[] (const range &r, u64 sum) {
+		for (u64 i = r.begin(); i != r.end(); ++i) {
+			NOP;
+			sum += i;
+		}
+		return sum;
+	}, std::plus<u64>());
+	asm volatile("" : : "r"(sum));
+}
+
+void
+scan(u64 *d, u64 n)
+{
+	typedef oneapi::tbb::blocked_range<u64> range;
+	oneapi::tbb::parallel_scan(range(0, n), (u64)0,
+			[d] (const range &r, u64 sum, bool is_final) {
+		for (u64 i = r.begin(); i != r.end(); ++i) {
+			sum += d[i];
+			if (is_final)
+				d[i] = sum;
+		}
+		return sum;
+	}, std::plus<u64>());
+}
+
+void
+parallel_scan(u64 n)
+{
+	scan(data, n);
+}
+
+void
+sort(u64 *d, u64 n)
+{
+	oneapi::tbb::parallel_sort(d, d + n);
+}
+
+void
+parallel_sort(u64 n)
+{
+	sort(data, n);
+}
+
+void
+for_each(u64 *d, u64 n)
+{
+	oneapi::tbb::parallel_for_each(d, d + n, [] (u64 &x) {
+		++x;
+	});
+}
+
+void
+parallel_for_each(u64 n)
+{
+	for_each(data, n);
+}
+
+void
+parallel_pipeline(u64 n)
+{
+	typedef std::chrono::steady_clock clk;
+	using oneapi::tbb::filter_mode;
+	using oneapi::tbb::make_filter;
+	struct item {
+		u64 i;
+		clk::time_point start;
+	};
+	auto work = [] {
+		for (u64 k = 0; k < pipeline_work; ++k)
+			NOP;
+	};
+	const filter_mode mode = filter_modes[pipeline_mode];
+	u64 next = 0;
+
+	auto f = make_filter<void, item>(filter_mode::serial_in_order,
+			[&] (oneapi::tbb::flow_control &fc) -> item {
+		if (next == n) {
+			fc.stop();
+			return item();
+		}
+		item it = {next++, clk::now()};
+		work();
+		return it;
+	});
+	for (unsigned s = 2; s < pipeline_stages; ++s)
+		f = f & make_filter<item, item>(mode, [&] (item it) {
+			work();
+			return it;
+		});
+	auto all = f & make_filter<item, void>(mode, [&] (item it) {
+		work();
+		std::chrono::duration<double> d = clk::now() - it.start;
+		pipeline_latencies[it.i] = d.count();
+	});
+	oneapi::tbb::parallel_pipeline(pipeline_tokens, all);
+}
+
+void
+pipeline_method::prepare(u64 *, u64 n)
+{
+	pipeline_latencies.assign(n, 0);
+}
+
+/* Scrambled indices (splitmix64), so that every run sorts the same input */
+void
+sort_method::prepare(u64 *d, u64 n)
+{
+	for (u64 i = 0; i < n; ++i) {
+		u64 z = (i + 1) * 0x9e3779b97f4a7c15;
+		z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9;
+		z = (z ^ z >> 27) * 0x94d049bb133111eb;
+		d[i] = z ^ z >> 31;
+	}
+}
+
+/* Calls f with an instance of the type of method, or returns false if there
+ * is no such method.
+ */
+template <typename F>
+bool
+dispatch(int method, F f)
+{
+	switch (method) {
+	case 0:
+		f(serial_method());
+		return true;
+	case 1:
+		f(parallel_for_method());
+		return true;
+	case 2:
+		f(task_group_method());
+		return true;
+	case 3:
+		f(nanosleep_method());
+		return true;
+	case 4:
+		f(stream_method());
+		return true;
+	case 5:
+		f(reduce_method());
+		return true;
+	case 6:
+		f(scan_method());
+		return true;
+	case 7:
+		f(sort_method());
+		return true;
+	case 8:
+		f(for_each_method());
+		return true;
+	case 9:
+		f(pipeline_method());
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Time one call of Method in arena, on data */
+template <typename Method>
+double
+timed(oneapi::tbb::task_arena &arena, u64 iterations)
+{
+	u64 *d = data;
+	Method::prepare(d, iterations);
+	auto start = std::chrono::high_resolution_clock::now();
+	arena.execute([=] {Method::run(d, iterations);});
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	return diff.count();
+}
+
+/* Time one call of go in arena, the way every method used to be called */
+double
+timed(oneapi::tbb::task_arena &arena, void (*go)(u64), u64 iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	arena.execute([=] {go(iterations);});
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	return diff.count();
+}
+
+/* First touch n elements of data from inside arena, so that (with the usual
+ * first-touch policy) the pages end up on the arena's node.
+ */
+void
+place_data(oneapi::tbb::task_arena &arena, u64 *d, u64 n)
+{
+	arena.execute([=] {
+		oneapi::tbb::parallel_for((u64)0, n, [d] (const u64 &i) {
+			d[i] = i;
+		});
+	});
+}
+
+/* Parse a sysfs CPU list such as "0-3,8-11" */
+std::vector<unsigned>
+parse_cpulist(const std::string &s)
+{
+	std::vector<unsigned> cpus;
+	const char *p = s.c_str();
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		unsigned lo = std::strtoul(p, &end, 10), hi = lo;
+		if (*end == '-')
+			hi = std::strtoul(end + 1, &end, 10);
+		for (unsigned c = lo; c <= hi; ++c)
+			cpus.push_back(c);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cpus;
+}
+
+/* Returns the NUMA nodes reported by TBB with the CPUs of each one, or fake
+ * nodes made of contiguous groups of CPUs when fake > 0. If there are more
+ * fake nodes than CPUs, CPUs are shared between nodes.
+ */
+std::vector<numa_node>
+numa_topology(unsigned fake)
+{
+	std::vector<numa_node> nodes;
+	unsigned nprocs = get_nprocs();
+	if (fake > 0) {
+		for (unsigned n = 0; n < fake; ++n) {
+			numa_node node = {-1, {}};
+			unsigned lo = n * nprocs / fake;
+			unsigned hi = std::max((n + 1) * nprocs / fake, lo + 1);
+			for (unsigned c = lo; c < hi; ++c)
+				node.cpus.push_back(c % nprocs);
+			nodes.push_back(node);
+		}
+		return nodes;
+	}
+	for (int id : oneapi::tbb::info::numa_nodes()) {
+		numa_node node = {id, {}};
+		std::ifstream f("/sys/devices/system/node/node"
+				+ std::to_string(id) + "/cpulist");
+		std::string line;
+		if (id >= 0 && std::getline(f, line))
+			node.cpus = parse_cpulist(line);
+		if (node.cpus.empty())
+			for (unsigned c = 0; c < nprocs; ++c)
+				node.cpus.push_back(c);
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+/* Returns the CPUs of each core type, from the least to the most performant.
+ * Prefers cpu_capacity, which is present on most hybrid ARM and x86 kernels,
+ * and falls back to the Intel hybrid PMU devices.
+ */
+std::vector<std::vector<unsigned>>
+core_type_cpus()
+{
+	std::vector<std::vector<unsigned>> types;
+	std::map<unsigned long, std::vector<unsigned>> by_capacity;
+	unsigned nprocs = get_nprocs();
+	for (unsigned c = 0; c < nprocs; ++c) {
+		std::ifstream f("/sys/devices/system/cpu/cpu"
+				+ std::to_string(c) + "/cpu_capacity");
+		unsigned long capacity;
+		if (!(f >> capacity)) {
+			by_capacity.clear();
+			break;
+		}
+		by_capacity[capacity].push_back(c);
+	}
+	for (auto &kv : by_capacity)
+		types.push_back(kv.second);
+	if (types.size() > 1)
+		return types;
+
+	types.clear();
+	for (auto pmu : {"cpu_atom", "cpu_core"}) {
+		std::ifstream f(std::string("/sys/devices/") + pmu + "/cpus");
+		std::string line;
+		if (std::getline(f, line))
+			types.push_back(parse_cpulist(line));
+	}
+	if (types.size() > 1)
+		return types;
+
+	types.assign(1, {});
+	for (unsigned c = 0; c < nprocs; ++c)
+		types[0].push_back(c);
+	return types;
+}
+
+/* Run Method once for each NUMA configuration (see top of file) */
+template <typename Method>
+void
+numa_run(const std::vector<numa_node> &nodes, int method, int threads,
+		u64 iterations)
+{
+	using oneapi::tbb::task_arena;
+	const unsigned nnodes = nodes.size();
+	std::vector<std::unique_ptr<task_arena>> arenas;
+	std::vector<std::unique_ptr<pinning_observer>> observers;
+	for (auto &node : nodes) {
+		int per_node = std::max(threads / (int)nnodes, 1);
+		/* No slot for us: we only submit the work and then wait
+		 * on one arena at a time, so every thread must be a worker
+		 */
+		arenas.emplace_back(new task_arena(
+				task_arena::constraints(node.id, per_node), 0));
+		observers.emplace_back(
+				new pinning_observer(*arenas.back(), node.cpus));
+	}
+	/* Arenas with all threads for local and remote */
+	task_arena first(task_arena::constraints(nodes.front().id, threads));
+	pinning_observer first_obs(first, nodes.front().cpus);
+	task_arena last(task_arena::constraints(nodes.back().id, threads));
+	pinning_observer last_obs(last, nodes.back().cpus);
+	std::vector<unsigned> interleaved;
+	for (unsigned i = 0; interleaved.size() < (unsigned)threads; ++i) {
+		auto &cpus = nodes[i % nnodes].cpus;
+		interleaved.push_back(cpus[(i / nnodes) % cpus.size()]);
+	}
+	task_arena cross(threads);
+	pinning_observer cross_obs(cross, interleaved);
+
+	std::unique_ptr<u64[]> buf(new u64[iterations]);
+	auto report = [&] (const char *config, double time) {
+		std::cout << method << tab;
+		std::cout << threads << tab;
+		std::cout << iterations << tab;
+		std::cout << time << tab;
+		std::cout << (double)iterations / time << tab;
+		std::cout << config << std::endl;
+	};
+
+	data = buf.get();
+	place_data(first, data, iterations);
+	report("local", timed<Method>(first, iterations));
+	report("remote", timed<Method>(last, iterations));
+	report("cross", timed<Method>(cross, iterations));
+
+	/* Each node gets its own slice of the buffer, placed locally */
+	std::vector<oneapi::tbb::task_group> groups(nnodes);
+	u64 slice = iterations / nnodes;
+	auto len = [&] (unsigned n) {
+		return n + 1 == nnodes ? iterations - n * slice : slice;
+	};
+	for (unsigned n = 0; n < nnodes; ++n) {
+		place_data(*arenas[n], buf.get() + n * slice, len(n));
+		Method::prepare(buf.get() + n * slice, len(n));
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	for (unsigned n = 0; n < nnodes; ++n) {
+		u64 *d = buf.get() + n * slice;
+		u64 l = len(n);
+		arenas[n]->execute([&, d, l] {
+			groups[n].run([=] {
+				Method::run(d, l);
+			});
+		});
+	}
+	for (unsigned n = 0; n < nnodes; ++n)
+		arenas[n]->execute([&] {groups[n].wait();});
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	report("spread", diff.count());
+	data = nullptr;
+}
+
 int
 main(int argc, char *argv[])
 {
 	int count = 1;
-	if (strcmp(argv[1], "-c") == 0) {
-		count = std::atoi(argv[2]);
+	bool numa = false;
+	unsigned fake_nodes = 0;
+	int core_type = -1;
+	bool persistent = false;
+	bool both = false;
+	size_t max_tokens = 0; /* 0 → 4 * threads */
+	int opt;
+	while ((opt = getopt(argc, argv, "c:NF:T:PDS:W:L:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		case 'N':
+			numa = true;
+			break;
+		case 'F':
+			fake_nodes = std::atoi(optarg);
+			break;
+		case 'T': {
+			char *end;
+			long t = std::strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || t < 0
+					|| t > INT_MAX) {
+				std::cerr << "Core type must be an integer >= 0"
+					<< std::endl;
+				return 1;
+			}
+			core_type = t;
+			break;
+		}
+		case 'P':
+			persistent = true;
+			break;
+		case 'D':
+			both = true;
+			break;
+		case 'S':
+			pipeline_stages = std::atoi(optarg);
+			break;
+		case 'W':
+			pipeline_work = std::strtoull(optarg, nullptr, 10);
+			break;
+		case 'L':
+			max_tokens = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0]
+				<< " [-c count] [-N] [-F nodes] [-T core_type] [-P]"
+				" [-D] [-S stages] [-W work] [-L tokens]"
+				<< std::endl;
+			return 1;
+		}
 	}
 	if (count < 1) {
 		std::cerr << "count must be >= 1" << std::endl;
 		return 1;
 	}
+	if (pipeline_stages < 2) {
+		std::cerr << "stages must be >= 2" << std::endl;
+		return 1;
+	}
+	if (numa && (core_type >= 0 || persistent || both)) {
+		std::cerr << "-N cannot be combined with -T, -P or -D"
+			<< std::endl;
+		return 1;
+	}
+	std::vector<numa_node> nodes;
+	if (numa)
+		nodes = numa_topology(fake_nodes);
+
+	/* Empty cpus means pinning to all of them */
+	std::vector<unsigned> cpus;
+	oneapi::tbb::task_arena::constraints constraints;
+	if (core_type >= 0) {
+		auto types = core_type_cpus();
+		auto tbb_types = oneapi::tbb::info::core_types();
+		if ((unsigned)core_type >= types.size()) {
+			std::cerr << "Core type must be < " << types.size()
+				<< std::endl;
+			return 1;
+		}
+		cpus = types[core_type];
+		/* Only trust TBB's ids if it sees the same core types */
+		if (tbb_types.size() == types.size())
+			constraints.set_core_type(tbb_types[core_type]);
+	}
 
+	std::map<int, std::unique_ptr<pinned_arena>> cache;
 	int method;
 	int threads;
 	u64 iterations;
@@ -104,42 +846,107 @@ main(int argc, char *argv[])
 			std::cerr << "Threads must be < 2" << std::endl;
 			continue;
 		}
-		oneapi::tbb::task_arena arena(threads);
-		pinning_observer observer(arena);
 
-		void (*go)(u64) = nullptr;
-		switch (method) {
-		case 0:
-			go = serial;
-			break;
-		case 1:
-			go = parallel_for;
-			break;
-		case 2:
-			go = task_group;
-			break;
-		case 3:
-			go = parallel_for_nanosleep;
-			break;
-		default:
-			std::cerr << "Method must be in {0, 1, 2, 3}" << std::endl;
+		bool uses_data = false;
+		if (!dispatch(method, [&] (auto m) {
+					uses_data = decltype(m)::uses_data;
+				})) {
+			std::cerr << "Method must be in {0, 1, ..., 9}" << std::endl;
 			continue;
 		}
 
-		for (int i = 0; i < count; i++) {
-			auto start = std::chrono::high_resolution_clock::now();
-			arena.execute([=] {go(iterations);});
-			auto end = std::chrono::high_resolution_clock::now();
-			std::chrono::duration<double> diff = end - start;
-			double time = diff.count();
+		if (numa) {
+			/* The NUMA configurations would share its latencies */
+			if (method == 9) {
+				std::cerr << "Method 9 cannot be combined with -N"
+					<< std::endl;
+				continue;
+			}
+			dispatch(method, [&] (auto m) {
+				for (int i = 0; i < count; i++)
+					numa_run<decltype(m)>(nodes, method,
+							threads, iterations);
+			});
+			continue;
+		}
+
+		std::unique_ptr<pinned_arena> fresh;
+		pinned_arena *pinned;
+		constraints.set_max_concurrency(threads);
+		if (persistent) {
+			auto &cached = cache[threads];
+			if (!cached) {
+				cached.reset(new pinned_arena(constraints, cpus));
+				cached->warm_up(threads);
+			}
+			pinned = cached.get();
+		} else {
+			fresh.reset(new pinned_arena(constraints, cpus));
+			pinned = fresh.get();
+		}
+		oneapi::tbb::task_arena &arena = pinned->arena;
+		std::unique_ptr<u64[]> buf;
+		if (uses_data) {
+			buf.reset(new u64[iterations]);
+			data = buf.get();
+			place_data(arena, data, iterations);
+		}
+
+		auto report = [&] (double time, const char *how) {
 			double thruput = (double)iterations / time;
 
 			std::cout << method << tab;
 			std::cout << threads << tab;
 			std::cout << iterations << tab;
 			std::cout << time << tab;
-			std::cout << thruput << std::endl;
+			std::cout << thruput;
+			if (method == 9) {
+				auto &l = pipeline_latencies;
+				std::sort(l.begin(), l.end());
+				if (l.empty())
+					l.push_back(0);
+				std::cout << tab
+					<< filter_mode_names[pipeline_mode];
+				std::cout << tab << pipeline_tokens;
+				std::cout << tab << l[(l.size() - 1) / 2];
+				std::cout << tab << l[(l.size() - 1) * 99 / 100];
+			}
+			if (core_type >= 0)
+				std::cout << tab << core_type;
+			if (persistent)
+				std::cout << tab << pinned->startup;
+			if (both)
+				std::cout << tab << how;
+			std::cout << std::endl;
+		};
+		auto tests = [&] {
+			for (int i = 0; i < count; i++) {
+				dispatch(method, [&] (auto m) {
+					typedef decltype(m) M;
+					if (both) {
+						M::prepare(data, iterations);
+						report(timed(arena,
+							method_functions[method],
+							iterations), "pointer");
+					}
+					report(timed<M>(arena, iterations),
+							"template");
+				});
+			}
+		};
+		if (method == 9) {
+			size_t tokens = max_tokens > 0 ? max_tokens : 4 * threads;
+			for (unsigned m = 0; m < 3; ++m) {
+				for (size_t t = 1; t <= tokens; t *= 2) {
+					pipeline_mode = m;
+					pipeline_tokens = t;
+					tests();
+				}
+			}
+		} else {
+			tests();
 		}
+		data = nullptr;
 	}
 
 	if (std::cin.eof())
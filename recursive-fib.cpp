@@ -1,6 +1,6 @@
 /* TBB parallel recursive Fibonacci number calculator which measures throughput
  *
- * usage: ./recursive-fib [n]
+ * usage: ./recursive-fib [-N] [-F nodes] [-T core_type] [-P] [n]
  *
  * If the n argument is given, each test will be ran n times instead of once.
  *
@@ -18,17 +18,56 @@
  * parallel tasks created. lb is information related to load balancing, which
  * contains the minimum, the standard deviation from the average, and the
  * maximum tasks per TBB thread.
+ *
+ * With -N, each test is instead ran once per NUMA configuration, and results
+ * are written with the following format:
+ *
+ * 	<n> <fib_number> <nthread> <jobs> <total_time> <tasks/sec> <config>
+ *
+ * Where config is one of:
+ *
+ * 	local	one arena of nthread threads on the first node
+ * 	cross	one arena of nthread threads pinned round-robin across all nodes
+ * 	spread	one arena of nthread/nodes threads per node, each computing the
+ * 		nth Fibonacci number concurrently (jobs counts all of them)
+ *
+ * -F nodes pretends that the machine has the given number of NUMA nodes by
+ * splitting the CPUs into that many contiguous groups, so -N can be exercised
+ * on a single-node box.
+ *
+ * With -T, arenas are constrained to the hardware threads of the given core
+ * type, numbered from the least to the most performant, and the core type is
+ * appended to every result. Core types come from tbb::info::core_types(), or
+ * from cpu_capacity in sysfs (or the cpu_atom/cpu_core devices) when TBB
+ * cannot tell them apart. -T cannot be combined with -N.
+ *
+ * With -P, one arena per thread count is kept across input lines instead of
+ * being created for every line. When an arena is created it is initialized
+ * and runs tasks until all of its threads have entered it (giving up after
+ * 100ms, in case TBB has fewer workers available); the time this took is the
+ * arena's startup latency, which is appended to every result after the core
+ * type. -P cannot be combined with -N.
  */
 
+#define TBB_PREVIEW_TASK_ARENA_CONSTRAINTS_EXTENSION 1
+
 #include <algorithm>
 #include <chrono>
+#include <climits>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <oneapi/tbb.h>
 #include <sched.h>
+#include <set>
+#include <string>
 #include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
 #define TAB '\t'
@@ -43,10 +82,37 @@ typedef std::uint64_t u64;
  */
 class pinning_observer : public oneapi::tbb::task_scheduler_observer {
 	const unsigned nprocs;
+	const std::vector<unsigned> cpus;
 	std::atomic<unsigned> counter;
+	/* Threads that entered, as a thread entering again counts once */
+	oneapi::tbb::spin_mutex seen_mutex;
+	std::set<std::thread::id> seen;
+	std::atomic<unsigned> nthreads;
 public:
 	pinning_observer(oneapi::tbb::task_arena &arena);
+	/* Pin round-robin over the given hardware threads instead */
+	pinning_observer(oneapi::tbb::task_arena &arena,
+			const std::vector<unsigned> &cpus);
 	void on_scheduler_entry(bool is_worker);
+	/* Number of distinct threads that entered the arena */
+	unsigned threads() const;
+};
+
+/* Arena and its observer, which -P keeps across input lines */
+struct pinned_arena {
+	oneapi::tbb::task_arena arena;
+	pinning_observer observer;
+	double startup; /* seconds to initialize and see every thread */
+
+	pinned_arena(const oneapi::tbb::task_arena::constraints &c,
+			const std::vector<unsigned> &cpus);
+	/* Initialize and make all nthread threads enter the arena */
+	void warm_up(unsigned nthread);
+};
+
+struct numa_node {
+	int id; /* TBB NUMA node id, -1 when faked */
+	std::vector<unsigned> cpus;
 };
 
 struct statistics {
@@ -71,6 +137,15 @@ u64 threads_created(int n);
 std::ostream& operator<<(std::ostream &str, const load_balance &lb);
 /* Internal for load_balance */
 statistics calc_statistics(const std::vector<std::uint64_t> &v);
+/* Parse a sysfs CPU list such as "0-3,8-11" */
+std::vector<unsigned> parse_cpulist(const std::string &s);
+/* NUMA nodes reported by TBB, or fake ones if fake > 0 */
+std::vector<numa_node> numa_topology(unsigned fake);
+/* Hardware threads of each core type, from the least to the most performant */
+std::vector<std::vector<unsigned>> core_type_cpus();
+/* Compute fib_num once for each NUMA configuration and print the results */
+void numa_run(const std::vector<numa_node> &nodes, int fib_num,
+		unsigned nthread);
 
 const char *progname = "recursive-fib";
 
@@ -114,7 +189,19 @@ threads_created(int n)
 pinning_observer::pinning_observer(oneapi::tbb::task_arena &arena):
 	oneapi::tbb::task_scheduler_observer(arena),
 	nprocs(get_nprocs()),
-	counter(0)
+	counter(0),
+	nthreads(0)
+{
+	observe(true);
+}
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &arena,
+		const std::vector<unsigned> &cpus):
+	oneapi::tbb::task_scheduler_observer(arena),
+	nprocs(get_nprocs()),
+	cpus(cpus),
+	counter(0),
+	nthreads(0)
 {
 	observe(true);
 }
@@ -124,10 +211,50 @@ pinning_observer::on_scheduler_entry(bool is_worker)
 {
 	cpu_set_t *mask = CPU_ALLOC(nprocs);
 	auto mask_size = CPU_ALLOC_SIZE(nprocs);
+	unsigned i = counter++;
 	CPU_ZERO_S(mask_size, mask);
-	CPU_SET_S(counter++ % nprocs, mask_size, mask);
+	if (cpus.empty())
+		CPU_SET_S(i % nprocs, mask_size, mask);
+	else
+		CPU_SET_S(cpus[i % cpus.size()], mask_size, mask);
 	if (sched_setaffinity(0, mask_size, mask))
 		die("sched_setaffinity: " << std::strerror(errno));
+	CPU_FREE(mask);
+	oneapi::tbb::spin_mutex::scoped_lock lock(seen_mutex);
+	if (seen.insert(std::this_thread::get_id()).second)
+		nthreads++;
+}
+
+unsigned
+pinning_observer::threads() const
+{
+	return nthreads;
+}
+
+pinned_arena::pinned_arena(const oneapi::tbb::task_arena::constraints &c,
+		const std::vector<unsigned> &cpus)
+	: arena(c), observer(arena, cpus), startup(0)
+{
+	/* nothing else */
+}
+
+void
+pinned_arena::warm_up(unsigned nthread)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto start_time = clock::now();
+	auto deadline = start_time + std::chrono::milliseconds(100);
+	arena.initialize();
+	/* Every iteration spins, so idle workers have to come and help */
+	arena.execute([&] {
+		oneapi::tbb::parallel_for(0u, nthread, [&] (unsigned) {
+			while (observer.threads() < nthread
+					&& clock::now() < deadline)
+				asm("pause");
+		}, oneapi::tbb::simple_partitioner());
+	});
+	std::chrono::duration<double> d = clock::now() - start_time;
+	startup = d.count();
 }
 
 load_balance::load_balance(int allowed, int slots)
@@ -173,12 +300,197 @@ calc_statistics(const std::vector<u64>& v)
 	return res;
 }
 
+std::vector<unsigned>
+parse_cpulist(const std::string &s)
+{
+	std::vector<unsigned> cpus;
+	const char *p = s.c_str();
+	while (*p != '\0' && *p != '\n') {
+		char *end;
+		unsigned lo = std::strtoul(p, &end, 10), hi = lo;
+		if (*end == '-')
+			hi = std::strtoul(end + 1, &end, 10);
+		for (unsigned c = lo; c <= hi; ++c)
+			cpus.push_back(c);
+		p = *end == ',' ? end + 1 : end;
+	}
+	return cpus;
+}
+
+/* Fake nodes are contiguous groups of hardware threads. If there are more
+ * fake nodes than hardware threads, nodes share them.
+ */
+std::vector<numa_node>
+numa_topology(unsigned fake)
+{
+	std::vector<numa_node> nodes;
+	unsigned nprocs = get_nprocs();
+	if (fake > 0) {
+		for (unsigned n = 0; n < fake; ++n) {
+			numa_node node = {-1, {}};
+			unsigned lo = n * nprocs / fake;
+			unsigned hi = std::max((n + 1) * nprocs / fake, lo + 1);
+			for (unsigned c = lo; c < hi; ++c)
+				node.cpus.push_back(c % nprocs);
+			nodes.push_back(node);
+		}
+		return nodes;
+	}
+	for (int id : oneapi::tbb::info::numa_nodes()) {
+		numa_node node = {id, {}};
+		std::ifstream f("/sys/devices/system/node/node"
+				+ std::to_string(id) + "/cpulist");
+		std::string line;
+		if (id >= 0 && std::getline(f, line))
+			node.cpus = parse_cpulist(line);
+		if (node.cpus.empty())
+			for (unsigned c = 0; c < nprocs; ++c)
+				node.cpus.push_back(c);
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+std::vector<std::vector<unsigned>>
+core_type_cpus()
+{
+	std::vector<std::vector<unsigned>> types;
+	std::map<unsigned long, std::vector<unsigned>> by_capacity;
+	unsigned nprocs = get_nprocs();
+	for (unsigned c = 0; c < nprocs; ++c) {
+		std::ifstream f("/sys/devices/system/cpu/cpu"
+				+ std::to_string(c) + "/cpu_capacity");
+		unsigned long capacity;
+		if (!(f >> capacity)) {
+			by_capacity.clear();
+			break;
+		}
+		by_capacity[capacity].push_back(c);
+	}
+	for (auto &kv : by_capacity)
+		types.push_back(kv.second);
+	if (types.size() > 1)
+		return types;
+
+	/* Intel hybrid parts without cpu_capacity */
+	types.clear();
+	for (auto pmu : {"cpu_atom", "cpu_core"}) {
+		std::ifstream f(std::string("/sys/devices/") + pmu + "/cpus");
+		std::string line;
+		if (std::getline(f, line))
+			types.push_back(parse_cpulist(line));
+	}
+	if (types.size() > 1)
+		return types;
+
+	types.assign(1, {});
+	for (unsigned c = 0; c < nprocs; ++c)
+		types[0].push_back(c);
+	return types;
+}
+
+void
+numa_run(const std::vector<numa_node> &nodes, int fib_num, unsigned nthread)
+{
+	using oneapi::tbb::task_arena;
+	const unsigned nnodes = nodes.size();
+	double jobs = threads_created(fib_num);
+	u64 result;
+	auto report = [&] (const char *config, double total_time, double jobs) {
+		std::cout << fib_num << TAB;
+		std::cout << result << TAB;
+		std::cout << nthread << TAB;
+		std::cout << jobs << TAB;
+		std::cout << total_time << TAB;
+		std::cout << jobs / total_time << TAB;
+		std::cout << config << std::endl;
+	};
+	auto timed = [&] (task_arena &arena) {
+		auto start_time = std::chrono::high_resolution_clock::now();
+		arena.execute([&] {result = parallel_fib(fib_num);});
+		auto end_time = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> d = end_time - start_time;
+		return d.count();
+	};
+
+	task_arena local(task_arena::constraints(nodes.front().id, nthread));
+	pinning_observer local_observer(local, nodes.front().cpus);
+	report("local", timed(local), jobs);
+
+	std::vector<unsigned> interleaved;
+	for (unsigned i = 0; interleaved.size() < nthread; ++i) {
+		auto &cpus = nodes[i % nnodes].cpus;
+		interleaved.push_back(cpus[(i / nnodes) % cpus.size()]);
+	}
+	task_arena cross(nthread);
+	pinning_observer cross_observer(cross, interleaved);
+	report("cross", timed(cross), jobs);
+
+	std::vector<std::unique_ptr<task_arena>> arenas;
+	std::vector<std::unique_ptr<pinning_observer>> observers;
+	std::vector<oneapi::tbb::task_group> groups(nnodes);
+	int per_node = std::max(nthread / nnodes, 1u);
+	for (auto &node : nodes) {
+		/* No slot for us: we only submit the work and then wait
+		 * on one arena at a time, so every thread must be a worker
+		 */
+		arenas.emplace_back(new task_arena(
+				task_arena::constraints(node.id, per_node), 0));
+		observers.emplace_back(
+				new pinning_observer(*arenas.back(), node.cpus));
+	}
+	auto start_time = std::chrono::high_resolution_clock::now();
+	std::vector<u64> results(nnodes);
+	for (unsigned n = 0; n < nnodes; ++n) {
+		arenas[n]->execute([&] {
+			u64 *r = &results[n];
+			groups[n].run([=] {*r = parallel_fib(fib_num);});
+		});
+	}
+	for (unsigned n = 0; n < nnodes; ++n)
+		arenas[n]->execute([&] {groups[n].wait();});
+	auto end_time = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> d = end_time - start_time;
+	result = results.front();
+	report("spread", d.count(), jobs * nnodes);
+}
+
 int
 main(int argc, char *argv[])
 {
 	progname = argv[0];
 	int tests = 1;
-	for (int i = 1; i < argc; ++i) {
+	bool numa = false;
+	unsigned fake_nodes = 0;
+	int core_type = -1;
+	bool persistent = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "NF:T:P")) != -1) {
+		switch (opt) {
+		case 'N':
+			numa = true;
+			break;
+		case 'F':
+			fake_nodes = std::atoi(optarg);
+			break;
+		case 'T': {
+			char *end;
+			long t = std::strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || t < 0
+					|| t > INT_MAX)
+				die("core type must be a non-negative integer");
+			core_type = t;
+			break;
+		}
+		case 'P':
+			persistent = true;
+			break;
+		default:
+			die("usage: " << progname
+					<< " [-N] [-F nodes] [-T core_type] [-P] [n]");
+		}
+	}
+	for (int i = optind; i < argc; ++i) {
 		char *end;
 		tests = std::strtoul(argv[i], &end, 10);
 		if (*end != '\0') {
@@ -189,23 +501,62 @@ main(int argc, char *argv[])
 
 	}
 
+	if (numa && (core_type >= 0 || persistent))
+		die("-N cannot be combined with -T or -P");
+	std::vector<numa_node> nodes;
+	if (numa)
+		nodes = numa_topology(fake_nodes);
+
+	/* Empty cpus means pinning to all hardware threads */
+	std::vector<unsigned> cpus;
+	oneapi::tbb::task_arena::constraints constraints;
+	if (core_type >= 0) {
+		auto types = core_type_cpus();
+		auto tbb_types = oneapi::tbb::info::core_types();
+		if ((unsigned)core_type >= types.size())
+			die("core type must be less than " << types.size());
+		cpus = types[core_type];
+		/* TBB's ids are only meaningful if it sees the same types */
+		if (tbb_types.size() == types.size())
+			constraints.set_core_type(tbb_types[core_type]);
+	}
+
+	std::map<unsigned, std::unique_ptr<pinned_arena>> cache;
 	int fib_num;
 	unsigned nthread;
 	while (std::cin >> fib_num >> nthread) {
-		oneapi::tbb::task_arena arena(nthread);
-		pinning_observer observer(arena);
+		if (numa) {
+			for (int i = 0; i < tests; ++i)
+				numa_run(nodes, fib_num, nthread);
+			continue;
+		}
+		std::unique_ptr<pinned_arena> fresh;
+		pinned_arena *pinned;
+		constraints.set_max_concurrency(nthread);
+		if (persistent) {
+			auto &cached = cache[nthread];
+			if (!cached) {
+				cached.reset(new pinned_arena(constraints, cpus));
+				cached->warm_up(nthread);
+			}
+			pinned = cached.get();
+		} else {
+			fresh.reset(new pinned_arena(constraints, cpus));
+			pinned = fresh.get();
+		}
+		oneapi::tbb::task_arena &arena = pinned->arena;
 		for (int i = 0; i < tests; ++i) {
+			u64 result;
 			auto start_time = std::chrono::high_resolution_clock::now();
-			auto result = parallel_fib(fib_num);
+			arena.execute([&] {result = parallel_fib(fib_num);});
 			auto end_time = std::chrono::high_resolution_clock::now();
 			std::chrono::duration<double> d = end_time - start_time;
 			double total_time = d.count();
 			double jobs = threads_created(fib_num);
 			double throughput = jobs / total_time;
-			int nslots =
-				oneapi::tbb::this_task_arena::max_concurrency();
+			int nslots = arena.max_concurrency();
 			load_balance lb(nthread, nslots);
-			parallel_fib_lb(fib_num, lb);
+			arena.execute([&] {parallel_fib_lb(fib_num, lb);});
 
 			std::cout << fib_num << TAB;
 			std::cout << result << TAB;
@@ -213,7 +564,12 @@ main(int argc, char *argv[])
 			std::cout << jobs << TAB;
 			std::cout << total_time << TAB;
 			std::cout << throughput << TAB;
-			std::cout << lb << std::endl;
+			std::cout << lb;
+			if (core_type >= 0)
+				std::cout << TAB << core_type;
+			if (persistent)
+				std::cout << TAB << pinned->startup;
+			std::cout << std::endl;
 		}
 	}
 
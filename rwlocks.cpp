@@ -0,0 +1,392 @@
+/* Read-mostly synchronization: reader-writer locks, seqlocks and RCU
+ *
+ * usage: ./rwlocks [-c count]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <iterations>
+ *
+ * For each line, threads threads pinned round-robin to the hardware threads
+ * perform iterations operations between them on a shared struct of eight
+ * integers, which writers keep equal to each other. Each operation is a read
+ * (copying the struct out and checking that it is consistent) with
+ * probability ratio, and a write (incrementing every field) otherwise, for
+ * ratios of 0.9, 0.99, 0.999 and 0.9999. The struct is protected by each of:
+ *
+ * 	shared_mutex	std::shared_mutex
+ * 	spin_rw_mutex	tbb::spin_rw_mutex
+ * 	seqlock		a sequence number: readers retry if a write overlapped
+ * 			their read, writers take a spin lock
+ * 	rcu		readers follow a pointer to an immutable copy, writers
+ * 			publish a new one and free the old one after a grace
+ * 			period, once every reader that could see it has finished
+ *
+ * Results are written to standard output with the following format:
+ *
+ * 	<method> <ratio> <threads> <iterations> <time> <reads/sec> <writes>
+ * 	<p50> <p99> <max>
+ *
+ * Where the last three columns describe the time it took to write, including
+ * waiting for the grace period with rcu, in seconds. Each line is ran count
+ * times (default 1).
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <oneapi/tbb.h>
+#include <sched.h>
+#include <shared_mutex>
+#include <sys/sysinfo.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::uint64_t u64;
+typedef std::chrono::steady_clock clk;
+
+constexpr char tab = '\t';
+constexpr unsigned cache_line = 64;
+constexpr unsigned fields = 8;
+
+struct payload {
+	u64 v[fields];
+};
+
+/* Read ratios, as the number of writes per million operations */
+struct ratio {
+	const char *name;
+	u64 write_ppm;
+};
+
+const ratio ratios[] = {
+	{"0.9", 100000}, {"0.99", 10000}, {"0.999", 1000}, {"0.9999", 100},
+};
+
+struct alignas(cache_line) padded {
+	std::atomic<u64> v {0};
+};
+
+/* The methods. Every one is created for a number of threads and has
+ * read(t, out), which copies the struct to out on behalf of thread t, and
+ * write(t).
+ */
+class shared_mutex_method {
+	std::shared_mutex mutex;
+	payload data {};
+public:
+	shared_mutex_method(unsigned) {}
+	void read(unsigned, payload &out);
+	void write(unsigned);
+};
+
+class spin_rw_method {
+	oneapi::tbb::spin_rw_mutex mutex;
+	payload data {};
+public:
+	spin_rw_method(unsigned) {}
+	void read(unsigned, payload &out);
+	void write(unsigned);
+};
+
+class seqlock_method {
+	alignas(cache_line) std::atomic<u64> seq;
+	oneapi::tbb::spin_mutex writers;
+	std::atomic<u64> data[fields];
+public:
+	seqlock_method(unsigned);
+	void read(unsigned, payload &out);
+	void write(unsigned);
+};
+
+/* Readers publish the grace period they started in (0 → not reading) */
+class rcu_method {
+	std::atomic<payload *> current;
+	alignas(cache_line) std::atomic<u64> gp;
+	std::vector<padded> readers;
+	std::mutex writers;
+
+	void synchronize();
+public:
+	rcu_method(unsigned nthreads);
+	~rcu_method();
+	void read(unsigned t, payload &out);
+	void write(unsigned);
+};
+
+void
+pin(unsigned cpu)
+{
+	unsigned nprocs = get_nprocs();
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(cpu % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+/* Spin, then yield in case whoever we wait for shares our core */
+inline void
+backoff(unsigned spins)
+{
+	if (spins < 1000)
+		asm("pause");
+	else
+		sched_yield();
+}
+
+/* p in [0, 1] of sorted v */
+double
+percentile(const std::vector<double> &v, double p)
+{
+	return v.empty() ? 0 : v[(size_t)(p * (v.size() - 1))];
+}
+
+void
+shared_mutex_method::read(unsigned, payload &out)
+{
+	std::shared_lock<std::shared_mutex> lock(mutex);
+	out = data;
+}
+
+void
+shared_mutex_method::write(unsigned)
+{
+	std::lock_guard<std::shared_mutex> lock(mutex);
+	for (auto &v : data.v)
+		++v;
+}
+
+void
+spin_rw_method::read(unsigned, payload &out)
+{
+	oneapi::tbb::spin_rw_mutex::scoped_lock lock(mutex, false);
+	out = data;
+}
+
+void
+spin_rw_method::write(unsigned)
+{
+	oneapi::tbb::spin_rw_mutex::scoped_lock lock(mutex, true);
+	for (auto &v : data.v)
+		++v;
+}
+
+seqlock_method::seqlock_method(unsigned) : seq(0)
+{
+	for (auto &v : data)
+		v = 0;
+}
+
+void
+seqlock_method::read(unsigned, payload &out)
+{
+	for (unsigned spins = 0;; ++spins) {
+		u64 s = seq.load(std::memory_order_acquire);
+		if (!(s & 1)) {
+			for (unsigned k = 0; k < fields; ++k)
+				out.v[k] = data[k].load(std::memory_order_relaxed);
+			/* Keeps the loads above before the second read of seq */
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (seq.load(std::memory_order_relaxed) == s)
+				return;
+		}
+		backoff(spins);
+	}
+}
+
+void
+seqlock_method::write(unsigned)
+{
+	oneapi::tbb::spin_mutex::scoped_lock lock(writers);
+	u64 s = seq.load(std::memory_order_relaxed);
+	seq.store(s + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for (auto &v : data)
+		v.store(v.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+	seq.store(s + 2, std::memory_order_release);
+}
+
+rcu_method::rcu_method(unsigned nthreads) :
+		current(new payload {}),
+		gp(1),
+		readers(nthreads)
+{
+}
+
+rcu_method::~rcu_method()
+{
+	delete current.load();
+}
+
+void
+rcu_method::read(unsigned t, payload &out)
+{
+	auto &r = readers[t].v;
+	r.store(gp.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	/* Pairs with the increment in synchronize(): either the writer sees
+	 * us reading or we see its new copy.
+	 */
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	out = *current.load(std::memory_order_acquire);
+	r.store(0, std::memory_order_release);
+}
+
+/* Waits until every read that started before it has finished */
+void
+rcu_method::synchronize()
+{
+	u64 g = gp.fetch_add(1, std::memory_order_seq_cst) + 1;
+	for (auto &r : readers) {
+		u64 x;
+		for (unsigned spins = 0; (x = r.v.load(std::memory_order_seq_cst))
+				!= 0 && x < g; ++spins)
+			backoff(spins);
+	}
+}
+
+void
+rcu_method::write(unsigned)
+{
+	std::lock_guard<std::mutex> lock(writers);
+	payload *old = current.load(std::memory_order_relaxed);
+	payload *copy = new payload(*old);
+	for (auto &v : copy->v)
+		++v;
+	current.store(copy, std::memory_order_release);
+	synchronize();
+	delete old;
+}
+
+template <typename Method>
+void
+run(const char *name, const ratio &r, unsigned nthreads, u64 iterations)
+{
+	Method method(nthreads);
+	std::vector<std::vector<double>> latencies(nthreads);
+	std::vector<padded> reads(nthreads);
+	std::atomic<u64> torn(0);
+	std::vector<std::thread> threads;
+	std::atomic<unsigned> ready(0);
+	std::atomic<bool> go(false);
+
+	for (unsigned t = 0; t < nthreads; ++t) {
+		u64 n = iterations / nthreads + (t < iterations % nthreads);
+		threads.emplace_back([&, t, n] {
+			pin(t);
+			u64 x = 0x9e3779b97f4a7c15 * (t + 1);
+			u64 nreads = 0;
+			payload p;
+			ready++;
+			while (!go)
+				;
+			for (u64 i = 0; i < n; ++i) {
+				/* xorshift64 */
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+				if (x % 1000000 < r.write_ppm) {
+					auto start = clk::now();
+					method.write(t);
+					std::chrono::duration<double> d =
+						clk::now() - start;
+					latencies[t].push_back(d.count());
+					continue;
+				}
+				method.read(t, p);
+				++nreads;
+				if (!std::all_of(p.v, p.v + fields, [&] (u64 v) {
+							return v == p.v[0];
+						}))
+					torn++;
+			}
+			reads[t].v = nreads;
+		});
+	}
+	while (ready != nthreads)
+		;
+	auto start = std::chrono::high_resolution_clock::now();
+	go = true;
+	for (auto &t : threads)
+		t.join();
+	auto end = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> diff = end - start;
+	double time = diff.count();
+
+	u64 nreads = 0;
+	for (auto &c : reads)
+		nreads += c.v;
+	std::vector<double> all;
+	for (auto &l : latencies)
+		all.insert(all.end(), l.begin(), l.end());
+	std::sort(all.begin(), all.end());
+	if (torn)
+		std::cerr << name << ": " << torn << " inconsistent reads"
+			<< std::endl;
+
+	std::cout << name << tab;
+	std::cout << r.name << tab;
+	std::cout << nthreads << tab;
+	std::cout << iterations << tab;
+	std::cout << time << tab;
+	std::cout << (double)nreads / time << tab;
+	std::cout << all.size() << tab;
+	std::cout << percentile(all, 0.5) << tab;
+	std::cout << percentile(all, 0.99) << tab;
+	std::cout << (all.empty() ? 0 : all.back()) << std::endl;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				<< std::endl;
+			return 1;
+		}
+	}
+	if (count < 1) {
+		std::cerr << "count must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	u64 iterations;
+
+	while (std::cin >> threads >> iterations) {
+		if (threads < 1) {
+			std::cerr << "Threads must be >= 1" << std::endl;
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			for (auto &r : ratios) {
+				run<shared_mutex_method>("shared_mutex", r, threads,
+						iterations);
+				run<spin_rw_method>("spin_rw_mutex", r, threads,
+						iterations);
+				run<seqlock_method>("seqlock", r, threads,
+						iterations);
+				run<rcu_method>("rcu", r, threads, iterations);
+			}
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}
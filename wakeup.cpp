@@ -0,0 +1,180 @@
+/* TBB worker wake-up latency after idle gaps
+ *
+ * usage: ./wakeup [-c count]
+ *
+ * Reads lines from standard input with the following format:
+ *
+ * 	<threads> <gap> <samples>
+ *
+ * For each line, an arena of the given number of worker threads is created
+ * and samples tasks are enqueued into it one at a time. Before each one is
+ * enqueued, the submitting thread (which is not part of the arena) waits gap
+ * nanoseconds after the previous task finished, giving the workers a chance to
+ * stop spinning and go to sleep. Sweep gaps with e.g.
+ *
+ * 	for g in 1000 10000 100000 1000000 10000000 100000000; do
+ * 		echo 4 $g 1000
+ * 	done | ./wakeup
+ *
+ * Results are written to standard output with the following format:
+ *
+ * 	<threads> <gap> <samples> <min> <p50> <p90> <p99> <max>
+ *
+ * Where the last five columns describe the distribution of the time from
+ * enqueueing a task until a worker started executing it, in seconds.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <oneapi/tbb.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::uint64_t u64;
+typedef std::chrono::steady_clock clk;
+
+class pinning_observer : public oneapi::tbb::task_scheduler_observer {
+	const unsigned nprocs;
+	std::atomic<unsigned> count;
+public:
+	pinning_observer(oneapi::tbb::task_arena &a);
+	void on_scheduler_entry(bool _w);
+};
+
+void wait_until(clk::time_point);
+double percentile(const std::vector<double> &, double);
+
+constexpr char tab = '\t';
+
+pinning_observer::pinning_observer(oneapi::tbb::task_arena &a):
+		oneapi::tbb::task_scheduler_observer(a),
+		nprocs(get_nprocs()),
+		count(0)
+{
+	observe(true);
+}
+
+void
+pinning_observer::on_scheduler_entry(bool _w)
+{
+	cpu_set_t *mask = CPU_ALLOC(nprocs);
+	auto size = CPU_ALLOC_SIZE(nprocs);
+	CPU_ZERO_S(size, mask);
+	CPU_SET_S(count++ % nprocs, size, mask);
+	sched_setaffinity(0, size, mask);
+	CPU_FREE(mask);
+}
+
+/* Sleep for long gaps, where nanosleep's overshoot does not matter, and spin
+ * for the rest, so that short gaps are still honoured.
+ */
+void
+wait_until(clk::time_point t)
+{
+	const auto slack = std::chrono::microseconds(100);
+	auto now = clk::now();
+	if (t - now > slack) {
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				t - now - slack).count();
+		struct timespec spec = {
+			.tv_sec = (time_t)(ns / 1000000000),
+			.tv_nsec = (long)(ns % 1000000000),
+		};
+		nanosleep(&spec, NULL);
+	}
+	while (clk::now() < t)
+		asm("pause");
+}
+
+/* p in [0, 1] of sorted v */
+double
+percentile(const std::vector<double> &v, double p)
+{
+	return v[(size_t)(p * (v.size() - 1))];
+}
+
+int
+main(int argc, char *argv[])
+{
+	int count = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:")) != -1) {
+		switch (opt) {
+		case 'c':
+			count = std::atoi(optarg);
+			break;
+		default:
+			std::cerr << "usage: " << argv[0] << " [-c count]"
+				<< std::endl;
+			return 1;
+		}
+	}
+	if (count < 1) {
+		std::cerr << "count must be >= 1" << std::endl;
+		return 1;
+	}
+
+	int threads;
+	u64 gap;
+	u64 samples;
+
+	while (std::cin >> threads >> gap >> samples) {
+		if (threads < 1 || samples < 1) {
+			std::cerr << "Threads and samples must be >= 1" << std::endl;
+			continue;
+		}
+		/* Let TBB create the workers even on hosts with fewer cores */
+		oneapi::tbb::global_control gc(
+				oneapi::tbb::global_control::max_allowed_parallelism,
+				threads + 1);
+		/* No slot for us: enqueued tasks can only run on workers */
+		oneapi::tbb::task_arena arena(threads, 0);
+		pinning_observer observer(arena);
+		arena.initialize();
+
+		for (int i = 0; i < count; i++) {
+			std::vector<double> latencies;
+			std::atomic<bool> done;
+			clk::time_point started;
+			auto finished = clk::now();
+			for (u64 s = 0; s < samples; ++s) {
+				wait_until(finished + std::chrono::nanoseconds(gap));
+				done = false;
+				auto submitted = clk::now();
+				arena.enqueue([&] {
+					started = clk::now();
+					done.store(true, std::memory_order_release);
+				});
+				/* Yield so a worker sharing our core can run */
+				while (!done.load(std::memory_order_acquire))
+					sched_yield();
+				finished = clk::now();
+				std::chrono::duration<double> d = started - submitted;
+				latencies.push_back(d.count());
+			}
+			std::sort(latencies.begin(), latencies.end());
+
+			std::cout << threads << tab;
+			std::cout << gap << tab;
+			std::cout << samples << tab;
+			std::cout << latencies.front() << tab;
+			std::cout << percentile(latencies, 0.5) << tab;
+			std::cout << percentile(latencies, 0.9) << tab;
+			std::cout << percentile(latencies, 0.99) << tab;
+			std::cout << latencies.back() << std::endl;
+		}
+	}
+
+	if (std::cin.eof())
+		return 0;
+
+	std::cerr << "Could not read from cin" << std::endl;
+	return 1;
+}